@@ -1,15 +1,42 @@
 #include "bitbuffer.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
 
 #include "coding.h"
 #include "utils.h"
 
+// the meaningful high bi bits of a partial byte
+#define PARTIAL_MASK(bi) ((unsigned char) (0xff00 >> (bi)))
+
+bitbuffer::bitbuffer(FILE* file, e_mode mode, int capacity, bool direct):
+	capacity(capacity), i(0), bi(0), bytes_read(0), file(file), mode(mode), direct(false), offset(0) {
+	assert(!direct || capacity % DIRECT_ALIGNMENT == 0);
+	buffer = new (std::align_val_t(DIRECT_ALIGNMENT)) unsigned char[capacity];
+	if(direct && mode == write && start_direct(file)) {
+		this->direct = true;
+		// positional writes continue wherever the stream left off
+		offset = ftell(file);
+	}
+}
+
+bitbuffer::~bitbuffer() {
+	if(mode == write)
+		flush();
+	if(file != stdout)
+		fclose(file);
+	operator delete[](buffer, std::align_val_t(DIRECT_ALIGNMENT));
+}
+
 void bitbuffer::push_bit(int b) {
 	assert(b == b & 1);
 	assert(mode == write);
-	buffer[i] |= b << (7 - bi);
+	buffer[i] = buffer[i] & PARTIAL_MASK(bi) | b << (7 - bi);
 	bi++;
 	if(bi == 8) {
 		i++;
@@ -33,16 +60,56 @@ void bitbuffer::push_byte(unsigned char b) {
 		buffer[i++] = b;
 		check_flush();
 	} else {
-		buffer[i++] |= b >> bi;
+		buffer[i] = buffer[i] & PARTIAL_MASK(bi) | b >> bi;
+		i++;
 		int _bi = bi;
 		bi = 0;
 		check_flush();
-		buffer[i] |= b << (8 - _bi);
+		buffer[i] = b << (8 - _bi);
 		bi = _bi;
 	}
 }
 
+void bitbuffer::push_bits(unsigned int bits, int n) {
+	assert(mode == write);
+	assert(n >= 0 && n <= 32);
+	if(n == 0) return;
+	if(i + 5 <= capacity) {
+		// line the bits up behind the partial byte and write the (at most 5) bytes they touch in one
+		// go, the bytes past i are assigned so whatever was left there doesn't matter
+		uint64_t v = (uint64_t) bits << (64 - n) >> bi;
+		buffer[i] = buffer[i] & PARTIAL_MASK(bi) | v >> 56;
+		buffer[i + 1] = v >> 48;
+		buffer[i + 2] = v >> 40;
+		buffer[i + 3] = v >> 32;
+		buffer[i + 4] = v >> 24;
+		i += (bi + n) >> 3;
+		bi = (bi + n) & 7;
+		check_flush();
+		return;
+	}
+	// near the end of the buffer fill the partial byte and then whole bytes
+	while(n > 0) {
+		int w = n < 8 - bi ? n : 8 - bi;
+		buffer[i] = buffer[i] & PARTIAL_MASK(bi) | (bits >> (n - w) & (1 << w) - 1) << (8 - bi - w);
+		bi += w;
+		n -= w;
+		if(bi == 8) {
+			i++;
+			bi = 0;
+			check_flush();
+		}
+	}
+}
+
 void bitbuffer::push_encoding_descriptor(encoding_descriptor& descriptor) {
+	if(descriptor.length <= 32) {
+		// most codewords, one append
+		uint32_t bits = (uint32_t) descriptor.encoding[0] << 24 | descriptor.encoding[1] << 16 |
+		                descriptor.encoding[2] << 8 | descriptor.encoding[3];
+		push_bits(bits >> (32 - descriptor.length), descriptor.length);
+		return;
+	}
 	// note floor division
 	for(int j = 0; j < descriptor.length / 8; j++) {
 		push_byte(descriptor.encoding[j]);
@@ -50,18 +117,20 @@ void bitbuffer::push_encoding_descriptor(encoding_descriptor& descriptor) {
 	// push partial byte
 	if(descriptor.length % 8) {
 		int w = descriptor.length % 8;
-		unsigned char l = descriptor.encoding[descriptor.encoding.size() - 1];
+		unsigned char l = descriptor.encoding[descriptor.length / 8];
 		// 3 cases
 		if(bi + w < 8) { // falls short
-			buffer[i] |= l >> bi;
+			buffer[i] = buffer[i] & PARTIAL_MASK(bi) | l >> bi;
 			bi += w;
 		} else if(bi + w == 8) { // fits perfectly
-			buffer[i++] |= l >> bi;
+			buffer[i] = buffer[i] & PARTIAL_MASK(bi) | l >> bi;
+			i++;
 			bi = 0;
 			check_flush();
 		} else {
 			// fill
-			buffer[i++] |= l >> bi;
+			buffer[i] = buffer[i] & PARTIAL_MASK(bi) | l >> bi;
+			i++;
 			int _bi = bi;
 			bi = 0;
 			check_flush();
@@ -75,7 +144,7 @@ void bitbuffer::push_encoding_descriptor(encoding_descriptor& descriptor) {
 unsigned char bitbuffer::peek_bit() {
 	assert(mode == read);
 	check_load();
-	assert(i < bytes_read);
+	check_eof();
 	return (buffer[i] >> (7 - bi)) & 1;
 }
 
@@ -100,6 +169,7 @@ unsigned char bitbuffer::pop_byte() {
 	//}
 	//return b;
 	check_load();
+	check_eof();
 	if(bi == 0) {
 		return buffer[i++];
 	} else {
@@ -107,38 +177,13 @@ unsigned char bitbuffer::pop_byte() {
 		b |= buffer[i++] << bi;
 		int _bi = bi;
 		check_load();
+		check_eof();
 		b |= buffer[i] >> (8 - _bi);
 		bi = _bi;
 		return b;
 	}
 }
 
-unsigned char bitbuffer::try_pop_bit() {
-	assert(mode == read);
-	if(!feof(file))
-		check_load();
-	if(bytes_read == 0)
-		assert(feof(file));
-	if(i < bytes_read) {
-		return pop_bit();
-	} else {
-		return 0;
-	}
-}
-
-unsigned char bitbuffer::pop_rest(unsigned char byte, int byte_i) {
-	// TODO: optimize this or rely on the compiler figuring it out?
-	assert(mode == read);
-	assert(byte_i < 8 && byte_i >= 0);
-	unsigned char mask = 1 << (7 - byte_i);
-	while(mask) {
-		if(try_pop_bit())
-			byte |= mask;
-		mask >>= 1;
-	}
-	return byte;
-}
-
 int bitbuffer::get_bi() {
 	return bi;
 }
@@ -151,18 +196,25 @@ void bitbuffer::check_load() {
 	}
 }
 
+void bitbuffer::check_eof() {
+	if(i >= bytes_read) {
+		eprintf("Error: Unexpected end of file, input appears corrupt.\n");
+		exit(1);
+	}
+}
+
 void bitbuffer::load() {
 	assert(mode == read);
-	assert(!feof(file));
-	bytes_read = read_buffer(buffer, 1, BUFFER_SIZE, file);
+	// reading past the end is caught by check_eof
+	bytes_read = feof(file) ? 0 : read_buffer(buffer, 1, capacity, file);
 	i = 0;
 	bi = 0;
 }
 
 void bitbuffer::check_flush() {
 	assert(mode == write);
-	assert(i <= BUFFER_SIZE);
-	if(i == BUFFER_SIZE) {
+	assert(i <= capacity);
+	if(i == capacity) {
 		flush();
 	}
 }
@@ -170,17 +222,23 @@ void bitbuffer::check_flush() {
 void bitbuffer::flush() {
 	assert(mode == write);
 	// if the buffer is being flushed because it's full, there shouldn't be a partial byte
-	assert(i != BUFFER_SIZE || bi == 0);
-	// if there is a partial byte, round up
-	if(bi) i++;
-	write_buffer(buffer, 1, i, file);
-	zero(i);
+	assert(i != capacity || bi == 0);
+	// if there is a partial byte, clear its unused bits and round up
+	if(bi) {
+		buffer[i] &= PARTIAL_MASK(bi);
+		i++;
+	}
+	if(direct) {
+		// O_DIRECT only takes whole aligned blocks, anything but a full buffer is the end of the
+		// output (or close to it) and may be followed by the header
+		if(i != capacity) {
+			end_direct(file);
+		}
+		write_at(buffer, i, offset, file);
+		offset += i;
+	} else {
+		write_buffer(buffer, 1, i, file);
+	}
 	i = 0;
 	bi = 0;
 }
-
-void bitbuffer::zero(int n) {
-	for(int j = 0; j < n; j++) {
-		buffer[j] = 0;
-	}
-}
@@ -4,6 +4,11 @@
 #include <stdio.h>
 
 #define BUFFER_SIZE 32768
+// Size of the buffers compressed and extracted data is written through, a multiple of
+// DIRECT_ALIGNMENT
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+// Alignment of buffers, sizes and file offsets for O_DIRECT writes
+#define DIRECT_ALIGNMENT 4096
 
 // coding.h includes this file and we need the encoding_descriptor, so forward dec
 class encoding_descriptor;
@@ -15,52 +20,53 @@ class encoding_descriptor;
 // - This is a unidirection buffer.
 // - This buffer will panic if errors occur.
 // - Ownership of the file pointer is transferred into this buffer.
+// - In write mode only the high bi bits of buffer[i] are meaningful, bytes are assigned rather than
+//   or'd into the first time they're touched so the buffer never has to be zeroed.
+// - Direct buffers write with O_DIRECT where available, bypassing the page cache. Full buffers are
+//   written aligned, the final partial write drops O_DIRECT.
 
 class bitbuffer {
 public:
 	enum e_mode { read, write };
 private:
 	// buffer contents are lazy-loaded in read mode
-	unsigned char buffer[BUFFER_SIZE];
+	// aligned to DIRECT_ALIGNMENT
+	unsigned char* buffer;
+	int capacity;
 	int i;
 	int bi;
 	int bytes_read;
 	FILE* file;
 	e_mode mode;
+	// direct writes go to the file descriptor at offset, bypassing the stream
+	bool direct;
+	long long offset;
 public:
-	bitbuffer(FILE* file, e_mode mode): i(0), bi(0), bytes_read(0), file(file), mode(mode) {
-		if(mode == write)
-			zero();
-	}
-	~bitbuffer() {
-		if(mode == write)
-			flush();
-		if(file != stdout)
-			fclose(file);
-	}
+	// direct requests O_DIRECT writes, capacity must then be a multiple of DIRECT_ALIGNMENT
+	bitbuffer(FILE* file, e_mode mode, int capacity = BUFFER_SIZE, bool direct = false);
+	~bitbuffer();
+	bitbuffer(const bitbuffer& other) = delete;
+	bitbuffer& operator=(const bitbuffer& other) = delete;
 	void push_bit(int b);
 	void push_byte(unsigned char b);
+	// pushes the low n bits of bits, most significant first (n <= 32)
+	void push_bits(unsigned int bits, int n);
 	void push_encoding_descriptor(encoding_descriptor& descriptor);
 	unsigned char peek_bit();
 	unsigned char pop_bit();
 	unsigned char pop_byte();
-	// pops enough bits to fill the rest of a byte
-	// if eof is reached, the byte is padded with zeroes
-	unsigned char pop_rest(unsigned char byte, int byte_i);
 	int get_bi();
 	// NOTE: This flush will round up to the nearest byte
 	void flush();
 private:
-	// pops a bit or returns 0 if eof is reached
-	unsigned char try_pop_bit();
 	// loads data if buffer has been consumed
 	void check_load();
 	// loads data from file into the buffer
 	void load();
+	// panics if a read ran past the end of the file
+	void check_eof();
 	// flushes if the buffer is full
 	void check_flush();
-	// zeroes buffer
-	void zero(int n = BUFFER_SIZE);
 };
 
 #endif
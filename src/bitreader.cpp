@@ -0,0 +1,31 @@
+#include "bitreader.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "utils.h"
+
+bitreader::bitreader(FILE* file, long long bytes, long long length):
+	pos(0), end(0), window(0), bits(0), left(length), unread(bytes), file(file) {
+	load();
+}
+
+bitreader::~bitreader() {
+	if(file != stdin)
+		fclose(file);
+}
+
+void bitreader::load() {
+	// past the end everything is zeroes, so a corrupt stream which consumed past the end can just
+	// start over from the end
+	if(pos > end) pos = end;
+	int kept = end - pos;
+	memmove(buffer, buffer + pos, kept);
+	int n = BUFFER_SIZE - kept < unread ? BUFFER_SIZE - kept : unread;
+	int bytes_read = n ? read_buffer(buffer + kept, 1, n, file) : 0;
+	// a file shorter than it claimed just ends early
+	unread = bytes_read < n ? 0 : unread - n;
+	pos = 0;
+	end = kept + bytes_read;
+	memset(buffer + end, 0, 8);
+}
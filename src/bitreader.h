@@ -0,0 +1,65 @@
+#ifndef BITREADER_H
+#define BITREADER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bitbuffer.h"
+
+// Reads a bitstream through a 64-bit window, most significant bit first. The window is refilled a
+// whole word at a time from a buffer padded with 8 zero bytes so refilling never checks for the end
+// of the data, and bits past the end read as zeroes.
+//
+// Note:
+// - Only the given number of bytes are read from the file, anything after (e.g. a trailer) is left
+//   alone.
+// - Ownership of the file pointer is transferred into this reader.
+
+class bitreader {
+	unsigned char buffer[BUFFER_SIZE + 8];
+	// next byte to move into the window and end of the loaded bytes
+	int pos;
+	int end;
+	uint64_t window;
+	// number of valid bits at the top of the window
+	int bits;
+	// data bits not consumed yet, negative once a read ran past the end
+	long long left;
+	// bytes of the file not loaded yet
+	long long unread;
+	FILE* file;
+public:
+	bitreader(FILE* file, long long bytes, long long length);
+	~bitreader();
+	bitreader(const bitreader& other) = delete;
+	bitreader& operator=(const bitreader& other) = delete;
+	// tops the window up to at least 56 bits
+	void refill() {
+		if(pos + 8 > end) {
+			load();
+		}
+		uint64_t word;
+		__builtin_memcpy(&word, buffer + pos, 8);
+		window |= __builtin_bswap64(word) >> bits;
+		pos += (63 - bits) >> 3;
+		bits |= 56;
+	}
+	// returns the next n bits (1 <= n <= 56) without consuming them, requires a refill beforehand
+	unsigned peek(int n) const {
+		return window >> (64 - n);
+	}
+	void consume(int n) {
+		window <<= n;
+		bits -= n;
+		left -= n;
+	}
+	long long remaining() const {
+		return left;
+	}
+private:
+	// moves the unconsumed bytes to the front of the buffer and loads more behind them, only runs
+	// once per buffer until the last 8 bytes
+	void load();
+};
+
+#endif
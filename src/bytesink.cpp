@@ -0,0 +1,103 @@
+#include "bytesink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#include "transform.h"
+#include "utils.h"
+
+bytesink::bytesink(FILE* file, size_t capacity, bool direct):
+	capacity(capacity), i(0), file(file), direct(false), offset(0), done(false), transform(0) {
+	buffer = new (std::align_val_t(DIRECT_ALIGNMENT)) unsigned char[capacity];
+	if(direct && start_direct(file)) {
+		this->direct = true;
+		// positional writes continue wherever the stream left off
+		offset = ftell(file);
+	}
+}
+
+bytesink::bytesink(unsigned char* memory, size_t size):
+	buffer(memory), capacity(size), i(0), file(null), direct(false), offset(0), done(false), transform(0) {}
+
+bytesink::bytesink(const byte_consumer& consumer, size_t capacity):
+	capacity(capacity), i(0), file(null), consumer(consumer), direct(false), offset(0), done(false),
+	transform(0) {
+	buffer = new (std::align_val_t(DIRECT_ALIGNMENT)) unsigned char[capacity];
+}
+
+bytesink::~bytesink() {
+	if(transform) {
+		// whatever is left, caller memory holds the whole output
+		inverse_transform(transform, buffer, i);
+	}
+	if(consumer) {
+		write_out(i);
+		operator delete[](buffer, std::align_val_t(DIRECT_ALIGNMENT));
+		return;
+	}
+	if(file == null) {
+		return;
+	}
+	if(direct) {
+		// the end of the output is rarely a whole block
+		end_direct(file);
+	}
+	write_out(i);
+	if(file != stdout)
+		fclose(file);
+	operator delete[](buffer, std::align_val_t(DIRECT_ALIGNMENT));
+}
+
+void bytesink::set_transform(int id) {
+	transform = id;
+}
+
+size_t bytesink::size() const {
+	return i;
+}
+
+void bytesink::push_bytes(const unsigned char* bytes, size_t n) {
+	while(n > 0) {
+		size_t m = capacity / 2 < n ? capacity / 2 : n;
+		unsigned char* out = reserve(m);
+		memcpy(out, bytes, m);
+		i += m;
+		bytes += m;
+		n -= m;
+	}
+}
+
+void bytesink::make_room(size_t& n) {
+	if(file == null && !consumer) {
+		if(i == capacity) {
+			eprintf("Error: Decoded output is larger than the buffer provided.\n");
+			exit(1);
+		}
+		n = capacity - i;
+		return;
+	}
+	// O_DIRECT only takes whole aligned blocks, the rest moves to the front
+	size_t count = direct ? i / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT : i;
+	if(transform) {
+		// only whole transform blocks can be undone, they're multiples of the O_DIRECT alignment
+		count = i / TRANSFORM_BLOCK * TRANSFORM_BLOCK;
+		inverse_transform(transform, buffer, count);
+	}
+	write_out(count);
+	memmove(buffer, buffer + count, i - count);
+	i -= count;
+}
+
+void bytesink::write_out(size_t count) {
+	if(consumer) {
+		if(!done && count) {
+			done = !consumer(buffer, count);
+		}
+	} else if(direct) {
+		write_at(buffer, count, offset, file);
+		offset += count;
+	} else {
+		write_buffer(buffer, 1, count, file);
+	}
+}
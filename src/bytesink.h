@@ -0,0 +1,76 @@
+#ifndef BYTESINK_H
+#define BYTESINK_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <functional>
+
+#include "bitbuffer.h"
+
+// Output for decoded data, which is always byte aligned so unlike bitbuffer there's no partial byte
+// to track. Decoders reserve room for a batch of symbols, write through a plain pointer and commit
+// the batch, so the end of the buffer is checked once per batch rather than once per symbol.
+//
+// The sink either writes to a file through a large aligned buffer (with O_DIRECT like bitbuffer),
+// straight into caller memory of a known size, in which case nothing is copied, or hands each full
+// buffer to a consumer. A consumer can stop the output early, decoders check stopped once per batch.
+//
+// The sink also undoes the transform of transformed files (see transform.h): whole blocks are
+// transformed back in the buffer just before they're written out, so the inverse runs on data
+// which is still in cache and the decoders never see it.
+//
+// Note:
+// - This sink will panic if errors occur, including output which doesn't fit in caller memory.
+// - Ownership of the file pointer is transferred into this sink.
+
+typedef std::function<bool(const unsigned char* data, size_t n)> byte_consumer;
+
+class bytesink {
+	unsigned char* buffer;
+	size_t capacity;
+	size_t i;
+	// null when writing to caller memory or a consumer
+	FILE* file;
+	byte_consumer consumer;
+	bool direct;
+	long long offset;
+	// the consumer asked to stop, anything after is dropped
+	bool done;
+	int transform;
+public:
+	// direct requests O_DIRECT writes, capacity must then be a multiple of DIRECT_ALIGNMENT
+	bytesink(FILE* file, size_t capacity = OUTPUT_BUFFER_SIZE, bool direct = false);
+	bytesink(unsigned char* memory, size_t size);
+	// consumer returns false once it doesn't want any more output
+	bytesink(const byte_consumer& consumer, size_t capacity = OUTPUT_BUFFER_SIZE);
+	~bytesink();
+	bytesink(const bytesink& other) = delete;
+	bytesink& operator=(const bytesink& other) = delete;
+	// Returns where the next n bytes go, n is at most half the capacity. Caller memory may have less
+	// room left, then n is lowered to what's left.
+	unsigned char* reserve(size_t& n) {
+		if(capacity - i < n) {
+			make_room(n);
+		}
+		return buffer + i;
+	}
+	// marks everything up to end as written, end is within the last reservation
+	void commit(unsigned char* end) {
+		i = end - buffer;
+	}
+	void push_bytes(const unsigned char* bytes, size_t n);
+	// bytes written to caller memory so far
+	size_t size() const;
+	bool stopped() const {
+		return done;
+	}
+	// the output is transformed, set before anything is written
+	void set_transform(int id);
+private:
+	// writes out what it can so n more bytes fit, or lowers n to the room left in caller memory
+	void make_room(size_t& n);
+	// writes out count bytes from the start of the buffer
+	void write_out(size_t count);
+};
+
+#endif
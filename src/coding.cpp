@@ -4,26 +4,30 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bitreader.h"
+#include "column_huffman.h"
+#include "escaped.h"
+#include "huffman.h"
+#include "markov_huffman.h"
+#include "pairs.h"
+#include "parallel.h"
+#include "parallel_decoder.h"
+#include "stored.h"
+#include "transform.h"
 #include "utils.h"
+#include "wide_huffman.h"
 
 void encoding_descriptor::push_bit(int b) {
-	if(length % 8 == 0) {
-		encoding.push_back(b << 7);
-	} else {
-		encoding[length / 8] |= b << (8 - length % 8 - 1);
-	}
+	assert(length < MAX_CODE_LENGTH);
+	encoding[length / 8] |= b << (8 - length % 8 - 1);
 	length++;
 }
 
 void encoding_descriptor::pop_bit() {
 	assert(length > 0);
 	length--;
-	if((length + 7) / 8 < encoding.size()) {
-		encoding.pop_back();
-	} else {
-		// reset popped bit
-		encoding[length / 8] &= ~(1 << (8 - length % 8 - 1));
-	}
+	// reset popped bit
+	encoding[length / 8] &= ~(1 << (8 - length % 8 - 1));
 }
 
 void encoding_descriptor::print() {
@@ -49,112 +53,506 @@ void encoding_descriptor::print() {
  *
  * Using the unused bytes like this also allows them to serve as a file signature check of sorts.
  *
+ * Coders other than simple huffman and markov-huffman don't fit in the encoder bit and use an
+ * extended two byte header instead:
+ * [metadata: 1byte] [coder type: 1byte] [data: .........]
+ * 0 1 0 0  0 R R R
+ * The extended header byte takes an ascii value of '@' to 'G' and can't be confused with the
+ * original header.
+ *
+ * The coder type byte holds the transform the input went through before coding (see transform.h)
+ * in its high nibble. Transformed files always use the extended header, whatever the coder.
+ * 0 0 0 0  T T T T  coder type (low nibble), transform (high nibble)
+ *
  * The data length in bits can be found from the file length and partial byte.
  *
- * TODO: Currently have to seek back to write the last byte. Consider putting header byte at the
- * end...
+ * Streams can't go back and fill in the header. They leave the header blank (complete = 1) and
+ * instead end with a trailer holding the final context and the completed header byte:
+ * [blank metadata] ([coder type]) [data: .........] [context: 2bytes] [metadata: 1byte]
+ *
+ * The header byte is written last with a positional write (pwrite) once the remainder is known.
+ *
+ * Appending (see append) continues the bitstream over the partial byte and the old trailer and
+ * leaves the file in the streamed layout, so the next append finds the context in the trailer.
  * TODO: CRC? Probably not needed for this proof of concept..
  * TODO: Store length of decoded data as another data integrity check? Probably not for the same
  * reason as above..
  */
 
-void i_coding_provider::compress(FILE* input_fd, FILE* output_fd) {
-	size_t bytes_read;
-	unsigned char input_buffer[BUFFER_SIZE];
-	bitbuffer output_buffer(output_fd, bitbuffer::write);
+int i_coding_provider::header_length(int type, int transform) {
+	return type < 2 && !transform ? 1 : 2;
+}
+
+unsigned char i_coding_provider::make_header(int type, int remainder, int transform) {
+	if(type < 2 && !transform) {
+		return 0x30 | (~type & 1) << 3 | remainder;
+	} else {
+		return 0x40 | remainder;
+	}
+}
+
+int i_coding_provider::parse_header(const unsigned char* header, int n) {
+	if(n == 0) {
+		return -1;
+	}
+	// only necessary to check header & 1<<7, however, checking the 0x30 serves as a file signature
+	// of sorts
+	// the complete bit doesn't matter here, a blank header still has the encoder bits
+	if((header[0] & 0x70) == 0x30) {
+		return ~(header[0] & 1<<3)>>3 & 1;
+	} else if((header[0] & 0x78) == 0x40 && n >= 2) {
+		int type = header[1] & 0xF;
+		int transform = header[1] >> 4;
+		// simple and markov-huffman only take the extended header with a transform
+		if((type < 2 && !transform) || !valid_transform(transform)) {
+			return -1;
+		}
+		return type;
+	} else {
+		return -1;
+	}
+}
+
+int i_coding_provider::header_transform(const unsigned char* header, int n) {
+	return (header[0] & 0x78) == 0x40 && n >= 2 ? header[1] >> 4 : 0;
+}
+
+i_coding_provider* i_coding_provider::load(int type, FILE* encoding_fd) {
+	// peeked rather than sized so any stream works
+	int first = fgetc(encoding_fd);
+	if(first != EOF) {
+		ungetc(first, encoding_fd);
+	}
+	bitbuffer buffer(encoding_fd, bitbuffer::read);
+	if(first == EOF && type == 0) {
+		// an empty simple huffman table (from an empty input) is written as an empty file
+		return new huffman_table();
+	}
+	// check that the correct encoding file was provided for our operation
+	if(buffer.peek_bit() != (type != 0)) {
+		eprintf("Error: Incorrect encoding table provided for current operation; "
+				"expected %s, found %s.\n",
+				type ? "Markov-Huffman" : "simple Huffman",
+				buffer.peek_bit() ? "Markov-Huffman" : "simple Huffman");
+		exit(1);
+	}
+	if(type == 0) {
+		// simple huffman
+		return new huffman_table(buffer);
+	} else if(type == 1) {
+		// markov-huffman
+		return new markov_huffman_table(buffer);
+	} else if(type == 2) {
+		// column-aware markov-huffman
+		return new column_huffman_table(buffer);
+	} else if(type == 4) {
+		// markov-huffman with escapes
+		return new escaped_huffman_table(buffer);
+	} else if(type == 5) {
+		// 16-bit symbols
+		return new wide_huffman_table(buffer);
+	} else {
+		// stored
+		return new stored_table(buffer);
+	}
+}
+
+int i_coding_provider::peek_type(FILE* input_fd) {
+	long pos = ftell(input_fd);
+	unsigned char header[2] = { 0, 0 };
+	int n = read_buffer(header, 1, 2, input_fd);
+	fseek(input_fd, pos, SEEK_SET);
+	return parse_header(header, n);
+}
+
+int i_coding_provider::peek_transform(FILE* input_fd) {
+	long pos = ftell(input_fd);
+	unsigned char header[2] = { 0, 0 };
+	int n = read_buffer(header, 1, 2, input_fd);
+	fseek(input_fd, pos, SEEK_SET);
+	return parse_header(header, n) == -1 ? 0 : header_transform(header, n);
+}
+
+long long i_coding_provider::coded_length(const context_counts& counts) {
+	long long bits = 0;
+	for(int context = 0; context < counts.contexts(); context++) {
+		const int* row = counts.find(context);
+		if(row == null) continue;
+		for(int c = 0; c < 256; c++) {
+			if(row[c]) {
+				bits += (long long) row[c] * get_encoding(context, c).length;
+			}
+		}
+	}
+	return bits;
+}
+
+int i_coding_provider::initial_context() {
+	return ' ';
+}
+
+int i_coding_provider::next_context(int, unsigned char c) {
+	return c;
+}
+
+bool i_coding_provider::byte_symbols() {
+	return true;
+}
+
+// Tables built from a different input can be missing codewords, tables with escapes can code
+// anything.
+static void missing_codeword() {
+	eprintf("Error: Input contains a symbol which isn't in the encoding table, build the table from "
+	        "this input or with escapes (-k).\n");
+	exit(1);
+}
+
+void i_coding_provider::compress(FILE* input_fd, FILE* output_fd, int pair_contexts, bool direct,
+                                 int transform) {
+	bitbuffer output_buffer(output_fd, bitbuffer::write, OUTPUT_BUFFER_SIZE, direct);
 	// push temp header byte
 	output_buffer.push_byte(1 << 7);
-	unsigned char prev = ' ';
+	if(header_length(get_type(), transform) == 2) {
+		output_buffer.push_byte(transform << 4 | get_type());
+	}
+	encode(input_fd, output_buffer, initial_context(), pair_contexts, transform);
+	// go back and write header....
+	int bi = output_buffer.get_bi();
+	output_buffer.flush();
+	unsigned char header = make_header(get_type(), (8 - bi) % 8, transform);
+	write_at(&header, 1, 0, output_fd);
+	// output_buffer manual flush guarantees internal state i=0 so the buffer won't be flushed on
+	// destruction here
+	// output_fd will be handled by the output bitbuffer
+	fclose(input_fd);
+}
+
+void i_coding_provider::append(FILE* input_fd, FILE* output_fd) {
+	int type = peek_type(output_fd);
+	if(type == -1) {
+		eprintf("Error while decoding file: Input appears corrupt.\n");
+		exit(1);
+	}
+	if(type != get_type()) {
+		eprintf("Error: File encoding method does not match provided encoding table.\n");
+		exit(1);
+	}
+	// the last block of a transformed file was transformed short, the input can't continue it
+	if(peek_transform(output_fd)) {
+		eprintf("Error: Can't append to a transformed file.\n");
+		exit(1);
+	}
+	if(!byte_symbols()) {
+		eprintf("Error: Can't append to a file with multi-byte symbols.\n");
+		exit(1);
+	}
+	unsigned char header;
+	read_at(&header, 1, 0, output_fd);
+	long long total = file_size(output_fd);
+	long long end = total;
+	unsigned char completed = header;
+	int context;
+	if(header & 1 << 7) {
+		// the trailer has the final context and the completed header
+		unsigned char trailer[TRAILER_LENGTH];
+		if(total - header_length(type) < TRAILER_LENGTH ||
+		   read_at(trailer, TRAILER_LENGTH, total - TRAILER_LENGTH, output_fd) != TRAILER_LENGTH) {
+			eprintf("Error while decoding file: Input appears corrupt.\n");
+			exit(1);
+		}
+		context = trailer[0] << 8 | trailer[1];
+		completed = trailer[2];
+		end -= TRAILER_LENGTH;
+	} else {
+		// files written by compress have no trailer, the final context has to be decoded once and
+		// then goes in a trailer
+		eprintf("File has no trailer, decoding it once to find where it left off...\n");
+		context = initial_context();
+		decompress(reopen(output_fd), [&](const unsigned char* data, size_t n) {
+			for(size_t i = 0; i < n; i++) {
+				context = next_context(context, data[i]);
+			}
+			return true;
+		});
+	}
+	// a symbol without a codeword would stop the append after it overwrote the old trailer, so the
+	// input is checked before anything is written
+	unsigned char input_buffer[BUFFER_SIZE];
+	size_t bytes_read;
+	int check = context;
+	while(bytes_read = read_buffer(input_buffer, 1, BUFFER_SIZE, input_fd)) {
+		for(size_t i = 0; i < bytes_read; i++) {
+			if(get_encoding(check, input_buffer[i]).length == 0) {
+				missing_codeword();
+			}
+			check = next_context(check, input_buffer[i]);
+		}
+	}
+	fseek(input_fd, 0, SEEK_SET);
+	// continue the bitstream from the partial byte
+	int remainder = completed & 7;
+	unsigned char partial = 0;
+	if(remainder) {
+		if(end <= header_length(type) || read_at(&partial, 1, end - 1, output_fd) != 1) {
+			eprintf("Error while decoding file: Input appears corrupt.\n");
+			exit(1);
+		}
+		end--;
+	}
+	fseek(output_fd, end, SEEK_SET);
+	bitbuffer output_buffer(output_fd, bitbuffer::write, OUTPUT_BUFFER_SIZE);
+	if(remainder) {
+		output_buffer.push_bits(partial >> remainder, 8 - remainder);
+	}
+	context = encode(input_fd, output_buffer, context, 0);
+	// the trailer, which is never shorter than before so nothing is left over from the old one
+	int bi = output_buffer.get_bi();
+	output_buffer.flush();
+	output_buffer.push_byte(context >> 8);
+	output_buffer.push_byte(context & 0xFF);
+	output_buffer.push_byte(make_header(type, (8 - bi) % 8));
+	output_buffer.flush();
+	header = 1 << 7 | make_header(type, 0);
+	write_at(&header, 1, 0, output_fd);
+	// output_fd will be handled by the output bitbuffer
+	fclose(input_fd);
+}
+
+int i_coding_provider::encode(FILE* input_fd, bitbuffer& output_buffer, int context, int pair_contexts,
+                              int transform) {
+	size_t bytes_read;
+	unsigned char input_buffer[BUFFER_SIZE];
+	pair_table* pairs = null;
+	// reads only come up short at the end so every buffer is a whole TRANSFORM_BLOCK but the last
 	while(bytes_read = read_buffer(input_buffer, 1, BUFFER_SIZE, input_fd)) {
-		for(int input_buffer_index = 0; input_buffer_index < bytes_read; input_buffer_index++) {
+		if(transform) {
+			forward_transform(transform, input_buffer, bytes_read);
+		}
+		int input_buffer_index = 0;
+		if(pair_contexts) {
+			if(pairs == null) {
+				// hot contexts are picked from the first buffer
+				pairs = new pair_table(*this, input_buffer, bytes_read, pair_contexts);
+			}
+			// two symbols per lookup where possible, the context is just the previous symbol
+			while(input_buffer_index + 1 < bytes_read) {
+				unsigned char c1 = input_buffer[input_buffer_index];
+				unsigned char c2 = input_buffer[input_buffer_index + 1];
+				const pair_code* row = pairs->row(context, c1);
+				if(row && row[c2].length) {
+					output_buffer.push_bits(row[c2].bits, row[c2].length);
+					context = c2;
+					input_buffer_index += 2;
+				} else {
+					encoding_descriptor& e = get_encoding(context, c1);
+					if(e.length == 0) {
+						missing_codeword();
+					}
+					context = c1;
+					output_buffer.push_encoding_descriptor(e);
+					input_buffer_index++;
+				}
+			}
+		}
+		for(; input_buffer_index < bytes_read; input_buffer_index++) {
 			// get encoding for character in input
-			encoding_descriptor& e = get_encoding(prev, input_buffer[input_buffer_index]);
-			assert(e.length != 0);
+			encoding_descriptor& e = get_encoding(context, input_buffer[input_buffer_index]);
+			// only tables built from other inputs can be missing codewords
+			if(e.length == 0) {
+				missing_codeword();
+			}
 			// update state
-			prev = input_buffer[input_buffer_index];
+			context = next_context(context, input_buffer[input_buffer_index]);
 			// write encoding
 			output_buffer.push_encoding_descriptor(e);
 		}
 	}
+	delete pairs;
 	// Check for read errors
 	if(bytes_read == -1) {
 		eprintf("Error occurred while reading input; %s.\n", strerror(errno));
 		exit(1);
 	}
-	// go back and write header....
-	int bi = output_buffer.get_bi();
-	output_buffer.flush();
-	fseek(output_fd, 0, SEEK_SET);
-	unsigned char header = 0x30 | (~get_type() & 1) << 3 | (8 - bi) % 8;
-	write_buffer(&header, 1, 1, output_fd);
-	// output_buffer manual flush guarantees internal state i=0 so the buffer won't be flushed on
-	// destruction here
-	// output_fd will be handled by the output bitbuffer
-	fclose(input_fd);
+	return context;
+}
+
+void i_coding_provider::decompress(FILE* input_fd, FILE* output_fd, bool direct) {
+	// the sink will close the output
+	bytesink output(output_fd, OUTPUT_BUFFER_SIZE, direct);
+	decompress(input_fd, output);
+}
+
+size_t i_coding_provider::decompress(FILE* input_fd, unsigned char* output, size_t size) {
+	bytesink sink(output, size);
+	decompress(input_fd, sink);
+	return sink.size();
+}
+
+void i_coding_provider::decompress(FILE* input_fd, const byte_consumer& consume) {
+	bytesink sink(consume);
+	decompress(input_fd, sink);
 }
 
-void i_coding_provider::decompress(FILE* input_fd, FILE* output_fd) {
-	bitbuffer input_buffer(input_fd, bitbuffer::read);
-	bitbuffer output_buffer(output_fd, bitbuffer::write);
+void i_coding_provider::decompress(FILE* input_fd, bytesink& output) {
 	// header
-	unsigned char header = input_buffer.pop_byte();
-	// only necessary to check header & 1<<7, however, checking the 0x30 serves as a file signature
-	// of sorts
-	if((header & 0xF0) != 0x30) {
+	int type = peek_type(input_fd);
+	if(type == -1) {
 		eprintf("Error while decoding file: Input appears corrupt.\n");
 		exit(1);
 	}
-	if((~(header & 1<<3)>>3 & 1) != get_type()) {
+	if(type != get_type()) {
 		eprintf("Error: File encoding method does not match provided encoding table.\n");
 		exit(1);
 	}
-	int remainder = header & 7;
-	// need to be careful with seeking in a file owned by the bitbuffer
-	long pos = ftell(input_fd);
-	fseek(input_fd, 0, SEEK_END);
-	int length = (ftell(input_fd) - 1) * 8 - remainder; // data length in bits
-	fseek(input_fd, pos, SEEK_SET);
+	int transform = peek_transform(input_fd);
+	int header_bytes = header_length(type, transform);
+	unsigned char header[2];
+	read_buffer(header, 1, header_bytes, input_fd);
+	output.set_transform(transform);
+	long long total = file_size(input_fd);
+	long long size = total - header_bytes;
+	unsigned char completed = header[0];
+	if(completed & 1 << 7) {
+		// blank header, the completed header is the last byte of the trailer
+		if(size < TRAILER_LENGTH) {
+			eprintf("Error while decoding file: Input appears corrupt.\n");
+			exit(1);
+		}
+		read_at(&completed, 1, total - 1, input_fd);
+		size -= TRAILER_LENGTH;
+	}
+	long long length = size * 8 - (completed & 7); // data length in bits
+	decode(input_fd, header_bytes, size, length, output);
+}
+
+void i_coding_provider::decode(FILE* input_fd, int header_length, long long size, long long length,
+                               bytesink& output) {
+	if(parallel_threads > 1 && size > PARALLEL_DECODE_CHUNK) {
+		// the decoder closes the input
+		parallel_decoder(*this).decode(input_fd, header_length, size, length, output);
+		return;
+	}
 	// main decoder body
-	unsigned char prev = ' ';
-	//const tree_node* node = null;
-	int bi = 0;
-	// the working byte and working byte index
-	unsigned char w = 0;
-	int wi = 0;
-	while(bi < length) {
-		w = input_buffer.pop_rest(w, wi);
-		const tree_node* node = decoding_lookup(prev, w);
-		assert(node != null);
-		assert(node->depth >= 1);
-		if(node->is_internal) {
-			bi += 8;
-			// need to traverse
-			while(node != null) {
-				int bit = input_buffer.pop_bit();
-				bi++;
-				if(bit) {
-					node = node->right;
-				} else {
-					node = node->left;
-				}
-				assert(node != null);
-				if(!node->is_internal) {
-					output_buffer.push_byte(node->value);
-					prev = node->value;
-					node = null;
-				}
+	// the reader keeps track of the length and owns the input from here on
+	bitreader input_buffer(input_fd, size, length);
+	int context = initial_context();
+	while(input_buffer.remaining() > 0 && !output.stopped()) {
+		// no codeword is longer than MAX_CODE_LENGTH bits so this many symbols can't run past the
+		// end of the data, the last few symbols are decoded one at a time
+		size_t batch = input_buffer.remaining() / MAX_CODE_LENGTH;
+		batch = batch > DECODE_BATCH ? DECODE_BATCH : batch ? batch : 1;
+		unsigned char* out = output.reserve(batch);
+		unsigned char* end = out + batch;
+		while(out != end) {
+			input_buffer.refill();
+			const tree_node* node = decoding_lookup(context, input_buffer.peek(8));
+			// no codeword, the context's table is empty
+			if(node == null) {
+				eprintf("Error while decoding file: Input appears corrupt.\n");
+				exit(1);
+			}
+			assert(node->depth >= 1);
+			if(node->is_internal) {
+				// codeword longer than 8 bits, walk the rest of the tree
+				input_buffer.consume(8);
+				do {
+					input_buffer.refill();
+					node = input_buffer.peek(1) ? node->right : node->left;
+					input_buffer.consume(1);
+				} while(node->is_internal);
+			} else {
+				input_buffer.consume(node->depth);
 			}
-			// reset working byte
-			w = 0;
-			wi = 0;
+			*out++ = node->value;
+			context = next_context(context, node->value);
+		}
+		output.commit(out);
+	}
+	// the last codeword ran past the end of the data
+	if(input_buffer.remaining() != 0 && !output.stopped()) {
+		eprintf("Error while decoding file: Input appears corrupt.\n");
+		exit(1);
+	}
+	// the bitreader will close the input
+}
+
+const char* i_coding_provider::verify(FILE* input_fd) {
+	unsigned char header[2] = { 0, 0 };
+	int n = read_buffer(header, 1, 2, input_fd);
+	int type = parse_header(header, n);
+	if(type == -1) {
+		fclose(input_fd);
+		return "invalid header";
+	}
+	if(type != get_type()) {
+		fclose(input_fd);
+		return "encoding method does not match the encoding table";
+	}
+	int header_bytes = header_length(type, header_transform(header, n));
+	long long total = file_size(input_fd);
+	long long size = total - header_bytes;
+	unsigned char completed = header[0];
+	int trailer_context = -1;
+	if(completed & 1 << 7) {
+		unsigned char trailer[TRAILER_LENGTH];
+		if(size < TRAILER_LENGTH ||
+		   read_at(trailer, TRAILER_LENGTH, total - TRAILER_LENGTH, input_fd) != TRAILER_LENGTH) {
+			fclose(input_fd);
+			return "missing trailer";
+		}
+		// the completed header is the blank one with the complete bit cleared and the remainder
+		if(trailer[2] != make_header(type, trailer[2] & 7, header_transform(header, n))) {
+			fclose(input_fd);
+			return "trailer does not match the header";
+		}
+		trailer_context = trailer[0] << 8 | trailer[1];
+		completed = trailer[2];
+		size -= TRAILER_LENGTH;
+	}
+	if(size < 0 || (size == 0 && completed & 7)) {
+		fclose(input_fd);
+		return "truncated";
+	}
+	long long length = size * 8 - (completed & 7);
+	fseek(input_fd, header_bytes, SEEK_SET);
+	// the reader owns the input from here on
+	bitreader input_buffer(input_fd, size, length);
+	int context = initial_context();
+	if(!verify_data(input_buffer, context)) {
+		return "codeword not in the encoding table";
+	}
+	if(input_buffer.remaining() != 0) {
+		return "last codeword runs past the end of the data";
+	}
+	input_buffer.refill();
+	if(completed & 7 && input_buffer.peek(completed & 7) != 0) {
+		return "padding bits are not zero";
+	}
+	if(trailer_context != -1 && context != trailer_context) {
+		return "trailer context does not match the data";
+	}
+	return null;
+}
+
+bool i_coding_provider::verify_data(bitreader& input_buffer, int& context) {
+	// the decoding loop of decode without the output
+	while(input_buffer.remaining() > 0) {
+		input_buffer.refill();
+		const tree_node* node = decoding_lookup(context, input_buffer.peek(8));
+		if(node == null) {
+			return false;
+		}
+		if(node->is_internal) {
+			input_buffer.consume(8);
+			do {
+				input_buffer.refill();
+				node = input_buffer.peek(1) ? node->right : node->left;
+				input_buffer.consume(1);
+			} while(node->is_internal);
 		} else {
-			output_buffer.push_byte(node->value);
-			prev = node->value;
-			w <<= node->depth;
-			wi = 8 - node->depth;
-			bi += node->depth;
+			input_buffer.consume(node->depth);
 		}
+		context = next_context(context, node->value);
 	}
-	assert(bi == length);
-	// bitbuffers will close the file descriptors
+	return true;
 }
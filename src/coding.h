@@ -1,37 +1,127 @@
 #ifndef CODING_H
 #define CODING_H
 
-#include <vector>
-
 #include "bitbuffer.h"
+#include "bitreader.h"
+#include "bytesink.h"
+#include "counting.h"
 #include "tree.h"
 
+// A huffman tree has at most 256 leaves so codewords are at most 255 bits long
+#define MAX_CODE_LENGTH 255
+
 struct encoding_descriptor {
 	int length;
-	std::vector<unsigned char> encoding;
-	encoding_descriptor(): length { 0 } {};
+	// stored inline so tables of descriptors are flat
+	unsigned char encoding[(MAX_CODE_LENGTH + 7) / 8];
+	encoding_descriptor(): length { 0 }, encoding {} {};
 	void push_bit(int b);
 	void pop_bit();
 	void print();
 };
 
+// Most symbols decoded per output reservation, see bytesink.h
+#define DECODE_BATCH 4096
+
+// Streamed output ends with [context: 2 bytes][header: 1 byte], see coding.cpp
+#define TRAILER_LENGTH 3
+
 class i_coding_provider {
+	friend class stream_encoder;
+	friend class stream_decoder;
+	friend class pair_table;
+	friend class parallel_decoder;
 public:
 	virtual ~i_coding_provider() = default;
 	virtual void print_table() = 0;
 	virtual void print_tree() = 0;
 	virtual void write_coding_tree(bitbuffer& buffer) = 0;
+	// returns the size in bits of what write_coding_tree writes
+	virtual long long table_length() = 0;
 	// compression/decompression logic common to all coders
 	// this class isn't a "pure interface" but that's ok
-	void compress(FILE* input_fd, FILE* output_fd);
-	void decompress(FILE* input_fd, FILE* output_fd);
-private:
+	// pair_contexts > 0 codes symbol pairs in that many of the hottest contexts, see pairs.h, only
+	// for coders whose context is the previous symbol
+	// direct writes the output with O_DIRECT where the file system allows it, see bitbuffer.h
+	// compress writes the header in place once the data is done so the output has to be a file
+	// transform is applied to the input before coding and recorded in the header so decompress
+	// undoes it, see transform.h, the table has to have been built from the transformed input
+	void compress(FILE* input_fd, FILE* output_fd, int pair_contexts = 0, bool direct = false,
+	              int transform = 0);
+	// data over PARALLEL_DECODE_CHUNK is decoded on the shared thread pool, see parallel_decoder.h
+	void decompress(FILE* input_fd, FILE* output_fd, bool direct = false);
+	// Appends the coded input to a compressed file opened for reading and writing, continuing its
+	// bitstream from the final partial byte. Only the partial byte, the trailer and the header are
+	// rewritten: the file ends up with a trailer holding the final context, so files which already
+	// have one (streamed or appended to before) are extended in time proportional to the input, files
+	// written by compress are decoded once to find their final context. Transformed files can't be
+	// appended to.
+	void append(FILE* input_fd, FILE* output_fd);
+	// decodes into caller memory of a known size and returns the decoded length, output which
+	// doesn't fit is an error
+	// the input is closed
+	size_t decompress(FILE* input_fd, unsigned char* output, size_t size);
+	// decodes without writing anything, handing the output to consume in blocks of up to
+	// OUTPUT_BUFFER_SIZE, decoding stops early once consume returns false
+	// the input is closed
+	void decompress(FILE* input_fd, const byte_consumer& consume);
+	// Checks a compressed file without decoding it anywhere: that the header is valid, every
+	// codeword resolves in the table, the last codeword ends exactly at the length the header gives,
+	// the padding bits are zero and a trailer's context is where decoding ends. Unlike decompress
+	// nothing exits, so one process can check many files. Returns null if the file is intact and
+	// what's wrong with it otherwise.
+	// the input is closed
+	const char* verify(FILE* input_fd);
+	// reads an encoding table written by write_coding_tree for a coder type
+	// ownership of the file pointer is transferred into this function
+	static i_coding_provider* load(int type, FILE* encoding_fd);
+	// reads the header of a compressed file and returns the coder type it was written with or -1 if
+	// the header is invalid
+	// the file position is restored
+	static int peek_type(FILE* input_fd);
+	// parses the first n bytes of a compressed file and returns the coder type or -1 if the header
+	// is invalid
+	static int parse_header(const unsigned char* header, int n);
+	// returns the transform a compressed file was written with, 0 for none, see transform.h
+	// the file position is restored
+	static int peek_transform(FILE* input_fd);
+	// parses the transform out of a header already found valid by parse_header
+	static int header_transform(const unsigned char* header, int n);
+	// returns the coded length in bits of data with the given symbol counts per context
+	virtual long long coded_length(const context_counts& counts);
+	// returns the header size in bytes for a coder type and transform
+	static int header_length(int type, int transform = 0);
+protected:
+	void decompress(FILE* input_fd, bytesink& output);
+	// Codes the input into the buffer starting from a context, returns the final context. Coders
+	// whose symbols aren't single bytes override this and decode, see wide_huffman.h.
+	virtual int encode(FILE* input_fd, bitbuffer& output_buffer, int context, int pair_contexts,
+	                   int transform = 0);
+	// decodes length bits of data following a header of header_length bytes into output, the input
+	// is closed
+	virtual void decode(FILE* input_fd, int header_length, long long size, long long length, bytesink& output);
+	// false for coders overriding encode and decode, the byte-at-a-time paths (streaming, parallel
+	// decoding and appending) can't be used with them
+	virtual bool byte_symbols();
+	// runs the decoding loop without output until the data ends from the context given, returns
+	// false if a codeword isn't in the table, context is left at the final context
+	virtual bool verify_data(bitreader& input_buffer, int& context);
+	static unsigned char make_header(int type, int remainder, int transform = 0);
 	// returns coder type
 	// 0 for simple huffman
 	// 1 for markov-huffman
+	// 2 for column-aware markov-huffman
+	// 3 for stored
+	// 4 for markov-huffman with escapes
+	// 5 for wide (16-bit symbol) huffman
 	virtual int get_type() = 0;
-	virtual encoding_descriptor& get_encoding(unsigned char prev, unsigned char c) = 0;
-	virtual const tree_node* decoding_lookup(unsigned char prev, unsigned char c) = 0;
+	// The context is the state coders select a table with. For most coders the context is simply
+	// the previous symbol, but coders are free to track more state (e.g. which field of a record
+	// the next symbol falls in).
+	virtual int initial_context();
+	virtual int next_context(int context, unsigned char c);
+	virtual encoding_descriptor& get_encoding(int context, unsigned char c) = 0;
+	virtual const tree_node* decoding_lookup(int context, unsigned char c) = 0;
 };
 
 #endif
@@ -0,0 +1,127 @@
+#include "column_huffman.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "bitbuffer.h"
+#include "coding.h"
+#include "counting.h"
+#include "markov_huffman.h"
+#include "tree.h"
+#include "utils.h"
+
+field_tracker::field_tracker(int columns, const std::string& separators):
+	columns(columns), separators(separators) {
+	for(int field = 0; field <= columns; field++) {
+		for(int c = 0; c < 256; c++) {
+			if(c == '\n') {
+				next_field[field][c] = 0;
+			} else if(separators.find((char) c) != std::string::npos) {
+				next_field[field][c] = field < columns ? field + 1 : columns;
+			} else {
+				next_field[field][c] = field;
+			}
+		}
+	}
+}
+
+int field_tracker::models() const {
+	return columns + 1;
+}
+
+column_huffman_table::column_huffman_table(const context_counts& counts, const field_tracker& fields):
+	fields(fields) {
+	for(int i = 0; i < fields.models(); i++) {
+		tables[i] = new markov_huffman_table(counts, 256 * i);
+	}
+}
+
+column_huffman_table::column_huffman_table(bitbuffer& buffer): fields(read_fields(buffer)) {
+	for(int i = 0; i < fields.models(); i++) {
+		tables[i] = new markov_huffman_table(buffer);
+	}
+}
+
+column_huffman_table::~column_huffman_table() {
+	for(int i = 0; i < fields.models(); i++) {
+		delete tables[i];
+	}
+}
+
+int column_huffman_table::get_type() {
+	return 2;
+}
+
+void column_huffman_table::print_table() {
+	for(int i = 0; i < fields.models(); i++) {
+		printf("Field %d%s:\n", i, i == fields.columns ? "+" : "");
+		tables[i]->print_table();
+	}
+}
+
+void column_huffman_table::print_tree() {
+	for(int i = 0; i < fields.models(); i++) {
+		printf("/* Field %d%s: */\n", i, i == fields.columns ? "+" : "");
+		tables[i]->print_tree();
+	}
+}
+
+long long column_huffman_table::table_length() {
+	// leading 1, type, column count, separator count and separators
+	long long bits = 1 + 8 * (3 + fields.separators.size());
+	for(int i = 0; i < fields.models(); i++) {
+		bits += tables[i]->table_length();
+	}
+	return bits;
+}
+
+int column_huffman_table::next_context(int context, unsigned char c) {
+	// no branching here, the field transitions are precomputed
+	return fields.next_field[context >> 8][c] << 8 | c;
+}
+
+encoding_descriptor& column_huffman_table::get_encoding(int context, unsigned char c) {
+	return tables[context >> 8]->get_encoding(context & 0xFF, c);
+}
+
+const tree_node* column_huffman_table::decoding_lookup(int context, unsigned char c) {
+	return tables[context >> 8]->decoding_lookup(context & 0xFF, c);
+}
+
+/*
+ * Output file format:
+ * Like markov-huffman files, column files start with a 1. The leading 1 is followed by:
+ *  [8-bit coder type][8-bit column count][8-bit separator count][8-bit separators...]
+ * And then one markov-huffman table (in the markov-huffman table format) for each modeled column
+ * plus one for the fields past the last column.
+ *
+ */
+
+void column_huffman_table::write_coding_tree(bitbuffer& buffer) {
+	buffer.push_bit(1);
+	buffer.push_byte(get_type());
+	buffer.push_byte(fields.columns);
+	buffer.push_byte(fields.separators.size());
+	for(char c : fields.separators) {
+		buffer.push_byte(c);
+	}
+	for(int i = 0; i < fields.models(); i++) {
+		tables[i]->write_coding_tree(buffer);
+	}
+}
+
+field_tracker column_huffman_table::read_fields(bitbuffer& buffer) {
+	// pop leading indicator bit
+	buffer.pop_bit();
+	int type = buffer.pop_byte();
+	int columns = buffer.pop_byte();
+	if(type != 2 || columns < 1 || columns > MAX_COLUMNS) {
+		eprintf("Error: Encoding table is not a valid column encoding table.\n");
+		exit(1);
+	}
+	std::string separators;
+	for(int n = buffer.pop_byte(); n > 0; n--) {
+		separators.push_back(buffer.pop_byte());
+	}
+	return field_tracker(columns, separators);
+}
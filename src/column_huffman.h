@@ -0,0 +1,53 @@
+#ifndef COLUMN_HUFFMAN_H
+#define COLUMN_HUFFMAN_H
+
+#include <string>
+
+#include "bitbuffer.h"
+#include "coding.h"
+#include "counting.h"
+#include "markov_huffman.h"
+#include "tree.h"
+
+#define MAX_COLUMNS 16
+// the table stores the separator count in a byte
+#define MAX_SEPARATORS 255
+
+// Tracks which field of a delimited record a symbol falls in. Fields are separated by any of the
+// separator characters and a newline starts a new record. Fields past the last modeled column all
+// share one extra model.
+struct field_tracker {
+	int columns;
+	std::string separators;
+	// next_field[field][c] is the field of the symbol following c
+	unsigned char next_field[MAX_COLUMNS + 1][256];
+	field_tracker(int columns, const std::string& separators);
+	int models() const;
+};
+
+// Markov-huffman coding where the context is (field index, previous symbol) instead of just the
+// previous symbol. The context is stored as field << 8 | prev.
+class column_huffman_table: public i_coding_provider {
+	field_tracker fields;
+	markov_huffman_table* tables[MAX_COLUMNS + 1];
+public:
+	column_huffman_table(const context_counts& counts, const field_tracker& fields);
+	column_huffman_table(bitbuffer& buffer);
+	~column_huffman_table() override;
+	column_huffman_table(const column_huffman_table& other) = delete;
+	column_huffman_table& operator=(const column_huffman_table& other) = delete;
+	column_huffman_table(column_huffman_table&& other) = delete;
+	column_huffman_table& operator=(column_huffman_table&& other) = delete;
+	int get_type() override;
+	void print_table() override;
+	void print_tree() override;
+	long long table_length() override;
+	int next_context(int context, unsigned char c) override;
+	encoding_descriptor& get_encoding(int context, unsigned char c) override;
+	const tree_node* decoding_lookup(int context, unsigned char c) override;
+	void write_coding_tree(bitbuffer& buffer) override;
+private:
+	static field_tracker read_fields(bitbuffer& buffer);
+};
+
+#endif
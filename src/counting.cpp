@@ -0,0 +1,108 @@
+#include "counting.h"
+#include <stdio.h>
+#include <vector>
+
+#include "bitbuffer.h"
+#include "transform.h"
+#include "utils.h"
+
+context_counts::context_counts(int contexts): slots(contexts, 0) {}
+
+context_counts::~context_counts() {
+	for(int* row : rows) {
+		delete[] row;
+	}
+}
+
+int context_counts::contexts() const {
+	return slots.size();
+}
+
+int context_counts::populated() const {
+	return rows.size();
+}
+
+int* context_counts::row(int context) {
+	if(slots[context] == 0) {
+		rows.push_back(new int[256]());
+		slots[context] = rows.size();
+	}
+	return rows[slots[context] - 1];
+}
+
+const int* context_counts::find(int context) const {
+	return slots[context] ? rows[slots[context] - 1] : null;
+}
+
+long long context_counts::footprint() const {
+	return slots.capacity() * sizeof(int) + rows.capacity() * sizeof(int*) +
+	       rows.size() * 256 * sizeof(int);
+}
+
+void construct_table(FILE* input_fd, symbol_counter counter, int transform) {
+	size_t bytes_read;
+	unsigned char buffer[BUFFER_SIZE];
+	int prev = ' ';
+	while(bytes_read = read_buffer(buffer, 1, BUFFER_SIZE, input_fd)) {
+		if(transform) {
+			forward_transform(transform, buffer, bytes_read);
+		}
+		for(int i = 0; i < bytes_read; i++) {
+			counter(prev, buffer[i]);
+			prev = buffer[i];
+		}
+	}
+}
+
+long long construct_table_sampled(FILE* input_fd, double rate, symbol_counter counter, int transform,
+                                  int alignment) {
+	long long size = file_size(input_fd);
+	long long chunks = (long long) (size * rate + SAMPLE_CHUNK_SIZE - 1) / SAMPLE_CHUNK_SIZE;
+	if(chunks < 1) chunks = 1;
+	long long stride = size / chunks;
+	if(stride < SAMPLE_CHUNK_SIZE) {
+		// the sample covers the whole input
+		stride = SAMPLE_CHUNK_SIZE;
+		chunks = (size + SAMPLE_CHUNK_SIZE - 1) / SAMPLE_CHUNK_SIZE;
+	}
+	// one extra byte in front of the chunk for its first symbol's prev
+	unsigned char buffer[SAMPLE_CHUNK_SIZE + 1];
+	long long sampled = 0;
+	for(long long k = 0; k < chunks; k++) {
+		long long offset = k * stride;
+		offset -= offset % alignment;
+		int bytes_read;
+		int prev;
+		if(transform) {
+			// chunks have to start on a block to be transformed like the encoder will, the previous
+			// block isn't read so the first symbol's prev is a guess
+			offset -= offset % TRANSFORM_BLOCK;
+			bytes_read = read_at(buffer + 1, SAMPLE_CHUNK_SIZE, offset, input_fd);
+			forward_transform(transform, buffer + 1, bytes_read);
+			prev = ' ';
+		} else if(offset == 0) {
+			bytes_read = read_at(buffer + 1, SAMPLE_CHUNK_SIZE, 0, input_fd);
+			prev = ' ';
+		} else {
+			bytes_read = read_at(buffer, SAMPLE_CHUNK_SIZE + 1, offset - 1, input_fd) - 1;
+			prev = buffer[0];
+		}
+		for(int i = 1; i <= bytes_read; i++) {
+			counter(prev, buffer[i]);
+			prev = buffer[i];
+		}
+		sampled += bytes_read;
+	}
+	return sampled;
+}
+
+void smooth_counts(context_counts& counts) {
+	for(int context = 0; context < counts.contexts(); context++) {
+		int* row = counts.row(context);
+		for(int c = 0; c < 256; c++) {
+			if(row[c] == 0) {
+				row[c] = 1;
+			}
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef COUNTING_H
+#define COUNTING_H
+
+#include <stdio.h>
+#include <functional>
+#include <vector>
+
+// Size of the strided chunks read while sampling
+#define SAMPLE_CHUNK_SIZE 65536
+
+typedef std::function<void(unsigned char, unsigned char)> symbol_counter;
+
+// Symbol counts for each context. Only contexts which have been seen are backed by memory, most of
+// the 256 (or more, with columns) contexts stay empty for text.
+class context_counts {
+	// row index of each context plus one, 0 while the context hasn't been seen
+	std::vector<int> slots;
+	std::vector<int*> rows;
+public:
+	context_counts(int contexts);
+	~context_counts();
+	context_counts(const context_counts& other) = delete;
+	context_counts& operator=(const context_counts& other) = delete;
+	int contexts() const;
+	// number of contexts backed by memory
+	int populated() const;
+	// returns the 256 counts of a context, allocating them on first use
+	int* row(int context);
+	// returns the counts of a context or null if it hasn't been seen
+	const int* find(int context) const;
+	void add(int context, unsigned char c) {
+		int slot = slots[context];
+		(slot ? rows[slot - 1] : row(context))[c]++;
+	}
+	// bytes held by the counts
+	long long footprint() const;
+};
+
+// Passes every (prev, c) pair in the input to the counter, after a transform if one is given (see
+// transform.h)
+void construct_table(FILE* input_fd, symbol_counter counter, int transform = 0);
+
+// Passes (prev, c) pairs from a sample of the input to the counter. The sample is made of evenly
+// strided chunks covering roughly rate (0, 1] of the input, starting at multiples of alignment. The
+// file position isn't touched.
+// Returns the number of bytes sampled.
+long long construct_table_sampled(FILE* input_fd, double rate, symbol_counter counter, int transform = 0,
+                                  int alignment = 1);
+
+// Gives every symbol a count of at least one so that symbols which weren't seen while counting
+// still get a codeword.
+void smooth_counts(context_counts& counts);
+
+#endif
@@ -0,0 +1,420 @@
+#include "daemon.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <list>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "coding.h"
+#include "huffman.h"
+#include "utils.h"
+
+#ifdef _WIN32
+
+void serve(const char*, int) {
+	eprintf("Error: Daemon mode isn't supported on this platform.\n");
+	exit(1);
+}
+
+#elif __linux__
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+enum daemon_op { op_compress, op_extract, op_count };
+
+const char* op_names[] = { "compress", "extract" };
+
+struct op_stats {
+	std::atomic<long long> requests;
+	std::atomic<long long> errors;
+	std::atomic<long long> total_us;
+	std::atomic<long long> max_us;
+	std::atomic<long long> buckets[DAEMON_LATENCY_BUCKETS];
+};
+
+// Counters shared by every worker, lives in a shared mapping made before the workers are forked
+struct daemon_stats {
+	op_stats ops[op_count];
+	std::atomic<long long> cache_hits;
+	std::atomic<long long> cache_misses;
+	// workers which exited on corrupt input (or anything else) and were replaced
+	std::atomic<long long> restarts;
+};
+
+static daemon_stats* stats = null;
+static volatile sig_atomic_t stopping = 0;
+
+static void handle_stop(int) {
+	stopping = 1;
+}
+
+static long long now_us() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (long long) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static void record(daemon_op op, long long us, bool ok) {
+	op_stats& s = stats->ops[op];
+	if(!ok) {
+		s.errors++;
+	}
+	s.total_us += us;
+	long long max = s.max_us;
+	while(us > max && !s.max_us.compare_exchange_weak(max, us));
+	int bucket = 0;
+	while(bucket < DAEMON_LATENCY_BUCKETS - 1 && us >= 1LL << bucket) {
+		bucket++;
+	}
+	s.buckets[bucket]++;
+}
+
+// Parsed coders keyed by a hash of the coder type and table contents, most recently used first
+class coder_cache {
+	struct entry {
+		uint64_t key;
+		i_coding_provider* coder;
+	};
+	std::list<entry> entries;
+	std::unordered_map<uint64_t, std::list<entry>::iterator> index;
+public:
+	~coder_cache() {
+		for(entry& e : entries) {
+			delete e.coder;
+		}
+	}
+	// returns the coder for a table file or null after reporting why it can't be loaded
+	i_coding_provider* get(int type, const char* table_path);
+};
+
+i_coding_provider* coder_cache::get(int type, const char* table_path) {
+	// the table is read every time so a changed table at the same path is picked up
+	FILE* table_fd = fopen(table_path, "rb");
+	if(table_fd == null) {
+		eprintf("Error while opening encoding input; %s.\n", strerror(errno));
+		return null;
+	}
+	std::string data;
+	char chunk[BUFFER_SIZE];
+	while(size_t n = read_buffer(chunk, 1, BUFFER_SIZE, table_fd)) {
+		data.append(chunk, n);
+	}
+	fclose(table_fd);
+	// FNV-1a
+	uint64_t key = 14695981039346656037ULL ^ type;
+	for(unsigned char c : data) {
+		key = (key ^ c) * 1099511628211ULL;
+	}
+	auto found = index.find(key);
+	if(found != index.end()) {
+		stats->cache_hits++;
+		entries.splice(entries.begin(), entries, found->second);
+		return found->second->coder;
+	}
+	stats->cache_misses++;
+	i_coding_provider* coder;
+	if(data.empty()) {
+		if(type != 0) {
+			eprintf("Error: Encoding table is empty.\n");
+			return null;
+		}
+		// an empty simple huffman table (from an empty input) is written as an empty file
+		coder = new huffman_table();
+	} else {
+		FILE* memory_fd = fmemopen(&data[0], data.size(), "rb");
+		if(memory_fd == null) {
+			eprintf("Error while reading encoding input; %s.\n", strerror(errno));
+			return null;
+		}
+		coder = i_coding_provider::load(type, memory_fd);
+	}
+	if(entries.size() == DAEMON_CACHE_ENTRIES) {
+		delete entries.back().coder;
+		index.erase(entries.back().key);
+		entries.pop_back();
+	}
+	entries.push_front({ key, coder });
+	index[key] = entries.begin();
+	return coder;
+}
+
+static bool open_files(const char* input, const char* output, FILE** input_fd, FILE** output_fd) {
+	*input_fd = fopen(input, "rb");
+	if(*input_fd == null) {
+		eprintf("Error while opening input; %s.\n", strerror(errno));
+		return false;
+	}
+	*output_fd = fopen(output, "wb");
+	if(*output_fd == null) {
+		eprintf("Error while opening output; %s.\n", strerror(errno));
+		fclose(*input_fd);
+		return false;
+	}
+	return true;
+}
+
+// Decodes into memory of the size the client gave and writes it out in one go, output which doesn't
+// fit is an error (which exits, like corrupt input). Closes both files.
+static bool extract_sized(i_coding_provider& coder, FILE* input_fd, FILE* output_fd, long long size) {
+	unsigned char* memory = new (std::nothrow) unsigned char[size ? size : 1];
+	if(memory == null) {
+		eprintf("Error: Can't allocate %lld bytes for the output.\n", size);
+		fclose(input_fd);
+		fclose(output_fd);
+		return false;
+	}
+	// input file descriptor ownership transferred into this method
+	size_t n = coder.decompress(input_fd, memory, size);
+	bool written = fwrite(memory, 1, n, output_fd) == n;
+	delete[] memory;
+	if(fclose(output_fd) != 0 || !written) {
+		eprintf("Error while writing output; %s.\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+static void reply(int connection, const std::string& text) {
+	const char* p = text.data();
+	size_t left = text.size();
+	while(left > 0) {
+		ssize_t n = write(connection, p, left);
+		if(n == -1) {
+			if(errno == EINTR) continue;
+			// the client went away, nothing to do about it
+			return;
+		}
+		p += n;
+		left -= n;
+	}
+}
+
+static std::string format_stats() {
+	std::string text;
+	char line[128];
+	for(int op = 0; op < op_count; op++) {
+		op_stats& s = stats->ops[op];
+		long long requests = s.requests;
+		snprintf(line, sizeof(line), "%s_requests %lld\n%s_errors %lld\n%s_mean_us %.1f\n%s_max_us %lld\n",
+		         op_names[op], requests, op_names[op], (long long) s.errors,
+		         op_names[op], requests ? (double) s.total_us / requests : 0.0,
+		         op_names[op], (long long) s.max_us);
+		text += line;
+		for(int bucket = 0; bucket < DAEMON_LATENCY_BUCKETS; bucket++) {
+			if(s.buckets[bucket]) {
+				snprintf(line, sizeof(line), "%s_under_%lld_us %lld\n", op_names[op], 1LL << bucket,
+				         (long long) s.buckets[bucket]);
+				text += line;
+			}
+		}
+	}
+	snprintf(line, sizeof(line), "cache_hits %lld\ncache_misses %lld\nrestarts %lld\n",
+	         (long long) stats->cache_hits, (long long) stats->cache_misses, (long long) stats->restarts);
+	text += line;
+	return text;
+}
+
+// Handles one request line, errors go to stderr which is the connection
+static void handle(int connection, coder_cache& cache, char* request) {
+	std::vector<char*> fields;
+	for(char* field = request; ; ) {
+		fields.push_back(field);
+		char* tab = strchr(field, '\t');
+		if(tab == null) break;
+		*tab = 0;
+		field = tab + 1;
+	}
+	long long start = now_us();
+	if(strcmp(fields[0], "stats") == 0 && fields.size() == 1) {
+		reply(connection, format_stats() + "ok\n");
+	} else if(strcmp(fields[0], "compress") == 0 && fields.size() == 5) {
+		stats->ops[op_compress].requests++;
+		int type = atoi(fields[1]);
+		FILE* input_fd;
+		FILE* output_fd;
+		i_coding_provider* coder;
+		if(type < 0 || type > 5 || strspn(fields[1], "0123456789") != strlen(fields[1])) {
+			eprintf("Error: Unknown coder type %s.\n", fields[1]);
+		} else if((coder = cache.get(type, fields[2])) && open_files(fields[3], fields[4], &input_fd, &output_fd)) {
+			// file descriptor ownership transferred into this method
+			coder->compress(input_fd, output_fd);
+			reply(connection, "ok\n");
+			record(op_compress, now_us() - start, true);
+			return;
+		}
+		record(op_compress, now_us() - start, false);
+	} else if(strcmp(fields[0], "extract") == 0 && (fields.size() == 4 || fields.size() == 5)) {
+		stats->ops[op_extract].requests++;
+		FILE* input_fd;
+		FILE* output_fd;
+		i_coding_provider* coder;
+		// -1 when the client doesn't know the decoded size
+		long long size = -1;
+		char* end = null;
+		if(fields.size() == 5) {
+			errno = 0;
+			size = strtoll(fields[4], &end, 10);
+		}
+		if(fields.size() == 5 && (*fields[4] < '0' || *fields[4] > '9' || *end != 0 || errno == ERANGE)) {
+			eprintf("Error: Invalid output size %s.\n", fields[4]);
+		} else if(open_files(fields[2], fields[3], &input_fd, &output_fd)) {
+			// the compressed file knows what it was encoded with
+			int type = i_coding_provider::peek_type(input_fd);
+			if(type == -1) {
+				eprintf("Error while decoding file: Input appears corrupt.\n");
+			} else if((coder = cache.get(type, fields[1]))) {
+				bool ok = true;
+				if(size == -1) {
+					// file descriptor ownership transferred into this method
+					coder->decompress(input_fd, output_fd);
+				} else {
+					ok = extract_sized(*coder, input_fd, output_fd, size);
+				}
+				if(ok) {
+					reply(connection, "ok\n");
+				}
+				record(op_extract, now_us() - start, ok);
+				return;
+			}
+			fclose(input_fd);
+			fclose(output_fd);
+		}
+		record(op_extract, now_us() - start, false);
+	} else {
+		eprintf("Error: Unknown request %s.\n", fields[0]);
+	}
+}
+
+static void work(int listener) {
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	// a client hanging up mid-reply shouldn't take the worker with it
+	signal(SIGPIPE, SIG_IGN);
+	int original_stderr = dup(STDERR_FILENO);
+	coder_cache cache;
+	char request[DAEMON_MAX_REQUEST];
+	while(true) {
+		int connection = accept(listener, null, null);
+		if(connection == -1) {
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+			eprintf("Error while accepting connection; %s.\n", strerror(errno));
+			exit(1);
+		}
+		// errors reported anywhere in the coders reach the client
+		dup2(connection, STDERR_FILENO);
+		int length = 0;
+		while(true) {
+			char* newline = (char*) memchr(request, '\n', length);
+			if(newline == null) {
+				if(length == DAEMON_MAX_REQUEST) {
+					eprintf("Error: Request is too long.\n");
+					break;
+				}
+				ssize_t n = read(connection, request + length, DAEMON_MAX_REQUEST - length);
+				if(n == -1 && errno == EINTR) continue;
+				if(n <= 0) break;
+				length += n;
+				continue;
+			}
+			*newline = 0;
+			handle(connection, cache, request);
+			length -= newline + 1 - request;
+			memmove(request, newline + 1, length);
+		}
+		dup2(original_stderr, STDERR_FILENO);
+		close(connection);
+	}
+}
+
+static pid_t spawn(int listener) {
+	pid_t pid = fork();
+	if(pid == -1) {
+		eprintf("Error while starting worker; %s.\n", strerror(errno));
+		exit(1);
+	}
+	if(pid == 0) {
+		work(listener);
+		exit(0);
+	}
+	return pid;
+}
+
+void serve(const char* socket_path, int workers) {
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(strlen(socket_path) >= sizeof(address.sun_path)) {
+		eprintf("Error: Socket path is too long.\n");
+		exit(1);
+	}
+	strcpy(address.sun_path, socket_path);
+	// a socket left behind by a previous daemon which wasn't shut down cleanly
+	struct stat s;
+	if(stat(socket_path, &s) == 0 && S_ISSOCK(s.st_mode)) {
+		unlink(socket_path);
+	}
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listener == -1 || bind(listener, (sockaddr*) &address, sizeof(address)) == -1 ||
+	   listen(listener, SOMAXCONN) == -1) {
+		eprintf("Error while listening on %s; %s.\n", socket_path, strerror(errno));
+		exit(1);
+	}
+	void* shared = mmap(null, sizeof(daemon_stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(shared == MAP_FAILED) {
+		eprintf("Error while mapping shared counters; %s.\n", strerror(errno));
+		exit(1);
+	}
+	stats = new (shared) daemon_stats();
+	// no SA_RESTART so waitpid returns when asked to stop
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_stop;
+	sigaction(SIGINT, &action, null);
+	sigaction(SIGTERM, &action, null);
+	std::vector<pid_t> pids;
+	for(int i = 0; i < workers; i++) {
+		pids.push_back(spawn(listener));
+	}
+	eprintf("Listening on %s with %d workers...\n", socket_path, workers);
+	while(!stopping) {
+		int status;
+		pid_t pid = waitpid(-1, &status, 0);
+		if(pid == -1) {
+			if(errno == EINTR) continue;
+			break;
+		}
+		for(pid_t& worker : pids) {
+			if(worker == pid) {
+				stats->restarts++;
+				worker = spawn(listener);
+			}
+		}
+	}
+	for(pid_t pid : pids) {
+		kill(pid, SIGTERM);
+	}
+	for(pid_t pid : pids) {
+		waitpid(pid, null, 0);
+	}
+	close(listener);
+	unlink(socket_path);
+	eprintf("Done.\n");
+}
+
+#else
+#error "Unsupported platform."
+#endif
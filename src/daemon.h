@@ -0,0 +1,29 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+// Number of parsed encoding tables each worker keeps around
+#define DAEMON_CACHE_ENTRIES 32
+// Longest request line accepted
+#define DAEMON_MAX_REQUEST 8192
+// Latency histogram buckets, bucket k counts requests which took under 2^k microseconds
+#define DAEMON_LATENCY_BUCKETS 24
+
+// Serves compress and extract requests on a Unix socket until interrupted. Requests are
+// newline-terminated lines with tab-separated fields:
+//
+//   compress <type> <table> <input> <output>   type is the coder type, see get_type
+//   extract <table> <input> <output> [size]    the type is read from the compressed file, with the
+//                                              decoded size known it's decoded straight into memory
+//                                              of that size, larger output is an error
+//   stats                                      latency counters, one "name value" line each
+//
+// Every request is answered with "ok", or with one or more lines starting with "Error". A
+// connection can carry any number of requests.
+//
+// Requests are served by a pool of worker processes sharing the listening socket. Each worker keeps
+// the coders it has parsed in an LRU cache keyed by a hash of the table file's contents, so a table
+// is only parsed once per worker as long as it's in use. The coders exit on corrupt input; a worker
+// sends the error to its client, exits, and is replaced by a fresh one.
+void serve(const char* socket_path, int workers);
+
+#endif
@@ -0,0 +1,195 @@
+#include "escaped.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bitbuffer.h"
+#include "coding.h"
+#include "counting.h"
+#include "huffman.h"
+#include "parallel.h"
+#include "tree.h"
+#include "utils.h"
+
+// pops the leading indicator bit and type so the fallback can be parsed in the initializer list
+static bitbuffer& read_header(bitbuffer& buffer) {
+	buffer.pop_bit();
+	if(buffer.pop_byte() != 4) {
+		eprintf("Error: Encoding table is not a valid escaped encoding table.\n");
+		exit(1);
+	}
+	return buffer;
+}
+
+escaped_huffman_table::escaped_huffman_table(const context_counts& counts) {
+	// order-0 counts over every context, smoothed so every symbol has a fallback codeword and scaled
+	// so tree weights fit in an int
+	long long totals[256];
+	long long sum = 0;
+	for(int c = 0; c < 256; c++) {
+		totals[c] = 1;
+		for(int context = 0; context < 256; context++) {
+			if(const int* row = counts.find(context)) {
+				totals[c] += row[c];
+			}
+		}
+		sum += totals[c];
+	}
+	long long scale = (sum + (1 << 30) - 1) / (1 << 30);
+	int fallback_counts[256];
+	for(int c = 0; c < 256; c++) {
+		fallback_counts[c] = totals[c] / scale ? totals[c] / scale : 1;
+	}
+	fallback.build(fallback_counts);
+	const int* rows[256];
+	for(int i = 0; i < 256; i++) {
+		rows[i] = counts.find(i);
+		escapes[i] = -1;
+		if(rows[i]) {
+			storage.emplace_back();
+			tables[i] = &storage.back();
+		} else {
+			tables[i] = &fallback;
+		}
+	}
+	thread_pool::shared().parallel_for(256, [&](int i) {
+		if(rows[i] == null) return;
+		int row[256];
+		int symbols = 0;
+		for(int c = 0; c < 256; c++) {
+			row[c] = rows[i][c];
+			if(row[c]) {
+				symbols++;
+			}
+		}
+		if(symbols < 256) {
+			// the escape takes the first unseen symbol and is weighted by how many symbols the
+			// context has seen (PPM's method C), contexts with many symbols are likely to see more
+			int escape = 0;
+			while(row[escape]) {
+				escape++;
+			}
+			row[escape] = symbols;
+			escapes[i] = escape;
+		}
+		tables[i]->build(row);
+		if(escapes[i] != -1) {
+			tables[i]->graft(escapes[i], fallback);
+		}
+	});
+}
+
+escaped_huffman_table::escaped_huffman_table(bitbuffer& buffer): fallback(read_header(buffer)) {
+	for(int c = 0; c < 256; c++) {
+		if(fallback.get_encoding(0, c).length == 0) {
+			eprintf("Error: Encoding table appears corrupt.\n");
+			exit(1);
+		}
+	}
+	for(int i = 0; i < 256; i++) {
+		escapes[i] = -1;
+		if(buffer.pop_bit()) {
+			if(buffer.pop_bit()) {
+				escapes[i] = buffer.pop_byte();
+			}
+			storage.emplace_back(buffer);
+			tables[i] = &storage.back();
+			if(escapes[i] != -1) {
+				tables[i]->graft(escapes[i], fallback);
+			}
+		} else {
+			tables[i] = &fallback;
+		}
+	}
+}
+
+int escaped_huffman_table::get_type() {
+	return 4;
+}
+
+void escaped_huffman_table::print_table() {
+	printf("Fallback table:\n");
+	fallback.print_table();
+	for(int i = 0; i < 256; i++) {
+		if(tables[i] != &fallback) {
+			printf("Prev '%s' table", charv(i).c_str());
+			if(escapes[i] != -1) {
+				printf(" (escape '%s')", charv(escapes[i]).c_str());
+			}
+			printf(":\n");
+			tables[i]->print_table();
+		}
+	}
+}
+
+void escaped_huffman_table::print_tree() {
+	printf("graph G {\n");
+	printf("\tpackmode=\"cluster\";\n");
+	int n = fallback.print_tree(true, 0, "Fallback");
+	for(int i = 0; i < 256; i++) {
+		if(tables[i] != &fallback) {
+			printf("/* Prev '%s' tree: */\n", charv(i).c_str());
+			n = tables[i]->print_tree(true, n, "Prev: " + charv(i));
+		}
+	}
+	printf("}\n");
+}
+
+long long escaped_huffman_table::table_length() {
+	// leading 1, type and a presence bit per tree
+	long long bits = 1 + 8 + fallback.table_length() + 256;
+	for(int i = 0; i < 256; i++) {
+		if(tables[i] != &fallback) {
+			bits += 1 + (escapes[i] != -1 ? 8 : 0) + tables[i]->table_length();
+		}
+	}
+	return bits;
+}
+
+long long escaped_huffman_table::footprint(const context_counts& counts) {
+	int full[256];
+	for(int c = 0; c < 256; c++) {
+		full[c] = 1;
+	}
+	// each context holds a copy of the fallback
+	long long bytes = sizeof(escaped_huffman_table) + huffman_table::footprint(full);
+	for(int context = 0; context < 256; context++) {
+		if(const int* row = counts.find(context)) {
+			bytes += huffman_table::footprint(row) + huffman_table::footprint(full);
+		}
+	}
+	return bytes;
+}
+
+encoding_descriptor& escaped_huffman_table::get_encoding(int prev, unsigned char c) {
+	return tables[prev]->get_encoding(prev, c);
+}
+
+const tree_node* escaped_huffman_table::decoding_lookup(int prev, unsigned char c) {
+	return tables[prev]->decoding_lookup(prev, c);
+}
+
+/*
+ * Output file format:
+ * Like markov-huffman files, escaped tables start with a 1, followed by the 8-bit coder type and the
+ * fallback's huffman tree. Then 256 entries of the following form:
+ *  [0]                                  : the context uses the fallback
+ *  [1][0][huffman tree]                 : tree with every symbol, no escape
+ *  [1][1][8-bit escape][huffman tree]   : tree with the escape as a plain leaf
+ *
+ */
+
+void escaped_huffman_table::write_coding_tree(bitbuffer& buffer) {
+	buffer.push_bit(1);
+	buffer.push_byte(get_type());
+	fallback.write_coding_tree(buffer);
+	for(int i = 0; i < 256; i++) {
+		buffer.push_bit(tables[i] != &fallback);
+		if(tables[i] != &fallback) {
+			buffer.push_bit(escapes[i] != -1);
+			if(escapes[i] != -1) {
+				buffer.push_byte(escapes[i]);
+			}
+			tables[i]->write_coding_tree(buffer);
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef ESCAPED_H
+#define ESCAPED_H
+
+#include <deque>
+
+#include "bitbuffer.h"
+#include "coding.h"
+#include "counting.h"
+#include "huffman.h"
+#include "tree.h"
+
+// Markov-huffman coding which can code any input, for tables shared between inputs. Every context
+// which hasn't seen all 256 symbols gets an escape symbol (a symbol it hasn't seen) followed by an
+// order-0 fallback tree holding every symbol, so an unseen (prev, c) is coded as the context's
+// escape codeword followed by c's fallback codeword. Contexts which were never seen use the
+// fallback directly. The fallback is grafted into each context's tree (see huffman_table::graft)
+// so coding and decoding work exactly like markov-huffman coding.
+class escaped_huffman_table: public i_coding_provider {
+	huffman_table fallback;
+	std::deque<huffman_table> storage;
+	huffman_table* tables[256];
+	// escape symbol of each context, -1 if the context has every symbol or was never seen
+	short escapes[256];
+public:
+	// builds the tables from markov-huffman counts, in parallel on the shared thread pool
+	escaped_huffman_table(const context_counts& counts);
+	escaped_huffman_table(bitbuffer& buffer);
+	escaped_huffman_table(const escaped_huffman_table& other) = delete;
+	escaped_huffman_table& operator=(const escaped_huffman_table& other) = delete;
+	escaped_huffman_table(escaped_huffman_table&& other) = delete;
+	escaped_huffman_table& operator=(escaped_huffman_table&& other) = delete;
+	int get_type() override;
+	void print_table() override;
+	void print_tree() override;
+	long long table_length() override;
+	encoding_descriptor& get_encoding(int prev, unsigned char c) override;
+	const tree_node* decoding_lookup(int prev, unsigned char c) override;
+	void write_coding_tree(bitbuffer& buffer) override;
+	// estimated bytes held by a table built from the counts
+	static long long footprint(const context_counts& counts);
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "fused_decoder.h"
+#include <algorithm>
+
+#include "bitreader.h"
+#include "bytesink.h"
+#include "coding.h"
+#include "huffman.h"
+#include "tree.h"
+
+static int max_depth(const tree_node* node) {
+	if(!node->is_internal) {
+		return 0;
+	}
+	return 1 + std::max(max_depth(node->left), max_depth(node->right));
+}
+
+fused_decoder::fused_decoder(huffman_table* const* tables) {
+	// the shared table for contexts without a tree, any bits are invalid there
+	entries.resize(2, entry { 0, 0, 0, 0 });
+	// lay the tables out first so entries can point at the tables of the contexts they lead to
+	for(int i = 0; i < 256; i++) {
+		if(tables[i]->empty()) {
+			states[i] = { 0, 1 };
+		} else {
+			// the root is always internal so there's at least one bit
+			int bits = std::min(max_depth(tables[i]->tree()), FUSED_ROOT_BITS);
+			states[i] = { (uint32_t) entries.size(), (unsigned char) bits };
+			entries.resize(entries.size() + (1 << bits));
+		}
+	}
+	for(int i = 0; i < 256; i++) {
+		if(!tables[i]->empty()) {
+			fill(states[i].start, states[i].bits, tables[i]->tree(), 0, 0);
+		}
+	}
+}
+
+void fused_decoder::fill(uint32_t start, int bits, const tree_node* node, uint32_t prefix, int depth) {
+	if(!node->is_internal) {
+		// every index starting with the codeword
+		state next = states[node->value];
+		entry e = { next.start, node->value, (unsigned char) depth, next.bits };
+		int free = bits - depth;
+		for(uint32_t i = 0; i < 1u << free; i++) {
+			entries[start + (prefix << free | i)] = e;
+		}
+	} else if(depth == bits) {
+		entries[start + prefix] = { (uint32_t) links.size(), 0, 0, (unsigned char) bits };
+		links.push_back(node);
+	} else {
+		fill(start, bits, node->left, prefix << 1, depth + 1);
+		fill(start, bits, node->right, prefix << 1 | 1, depth + 1);
+	}
+}
+
+int fused_decoder::walk(bitreader& input_buffer, state& s, entry e) const {
+	if(e.next_bits == 0) {
+		return -1;
+	}
+	// codeword longer than the table's bits, walk the rest of the tree
+	input_buffer.consume(e.next_bits);
+	const tree_node* node = links[e.next];
+	do {
+		input_buffer.refill();
+		node = input_buffer.peek(1) ? node->right : node->left;
+		input_buffer.consume(1);
+	} while(node->is_internal);
+	s = states[node->value];
+	return node->value;
+}
+
+bool fused_decoder::decode(bitreader& input_buffer, int context, bytesink& output) const {
+	state s = states[context];
+	while(input_buffer.remaining() > 0 && !output.stopped()) {
+		// same batching as i_coding_provider::decode
+		size_t batch = input_buffer.remaining() / MAX_CODE_LENGTH;
+		batch = batch > DECODE_BATCH ? DECODE_BATCH : batch ? batch : 1;
+		unsigned char* out = output.reserve(batch);
+		unsigned char* end = out + batch;
+		while(out != end) {
+			int symbol = step(input_buffer, s);
+			if(symbol == -1) {
+				return false;
+			}
+			*out++ = symbol;
+		}
+		output.commit(out);
+	}
+	// the last codeword ran past the end of the data
+	return input_buffer.remaining() == 0 || output.stopped();
+}
+
+bool fused_decoder::verify(bitreader& input_buffer, int& context) const {
+	state s = states[context];
+	while(input_buffer.remaining() > 0) {
+		int symbol = step(input_buffer, s);
+		if(symbol == -1) {
+			return false;
+		}
+		context = symbol;
+	}
+	return true;
+}
@@ -0,0 +1,78 @@
+#ifndef FUSED_DECODER_H
+#define FUSED_DECODER_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "bitreader.h"
+#include "bytesink.h"
+#include "huffman.h"
+#include "tree.h"
+
+// Most bits a context's lookup table is indexed with, longer codewords finish with a tree walk
+#define FUSED_ROOT_BITS 9
+
+// Serial Markov-Huffman decoding as a state machine over flat lookup tables.
+//
+// Every context with a tree gets a table indexed by the next bits of the input, laid out one after
+// the other in one allocation. An entry holds the symbol the bits start with, its codeword length
+// and the table of the context the symbol leads to (its start and how many bits index it), so a
+// decoding step is one load plus a shift and a consume, and the next lookup only depends on the
+// entry just loaded rather than on the tables and tree nodes behind decoding_lookup.
+//
+// A context's table is indexed with as many bits as its longest codeword, up to FUSED_ROOT_BITS,
+// so contexts with a few symbols (most of them in text) take a few entries and the tables of the
+// hot contexts are more likely to stay in cache. Entries for codewords longer than that link to the
+// tree node the bits lead to and the rest is walked bit by bit.
+//
+// Contexts are previous symbols, so this is only for markov_huffman_table.
+class fused_decoder {
+	struct entry {
+		// start of the next context's table, or the index in links of the node to walk on from
+		uint32_t next;
+		unsigned char symbol;
+		// codeword length, 0 for a link or a bit pattern no codeword starts with
+		unsigned char length;
+		// index bits of the next context's table, 0 unless the bits start a codeword or a link
+		unsigned char next_bits;
+	};
+	struct state {
+		uint32_t start;
+		unsigned char bits;
+	};
+	std::vector<entry> entries;
+	// internal nodes the links continue from
+	std::vector<const tree_node*> links;
+	// table of each context, contexts without a tree share a table of invalid entries
+	state states[256];
+public:
+	// the tables are built from the trees, the huffman tables must outlive the decoder
+	fused_decoder(huffman_table* const* tables);
+	fused_decoder(const fused_decoder& other) = delete;
+	fused_decoder& operator=(const fused_decoder& other) = delete;
+	// Decodes until the data ends from the given context into output (or until it stops), see
+	// i_coding_provider::decode. Returns false if the input is corrupt.
+	bool decode(bitreader& input_buffer, int context, bytesink& output) const;
+	// decodes without output, see i_coding_provider::verify_data
+	bool verify(bitreader& input_buffer, int& context) const;
+private:
+	// fills the entries of a table of bits index bits starting at start for the subtree at node,
+	// which the first depth bits of the index lead to
+	void fill(uint32_t start, int bits, const tree_node* node, uint32_t prefix, int depth);
+	// Decodes one symbol and moves the state on, returns -1 if the bits aren't a codeword. Inlined
+	// into both loops.
+	int step(bitreader& input_buffer, state& s) const {
+		input_buffer.refill();
+		entry e = entries[s.start + input_buffer.peek(s.bits)];
+		if(e.length != 0) {
+			input_buffer.consume(e.length);
+			s = { e.next, e.next_bits };
+			return e.symbol;
+		}
+		return walk(input_buffer, s, e);
+	}
+	// the slow path of step for links and invalid entries
+	int walk(bitreader& input_buffer, state& s, entry e) const;
+};
+
+#endif
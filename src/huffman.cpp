@@ -9,32 +9,34 @@
 #include "tree.h"
 #include "utils.h"
 
-huffman_table::huffman_table(): huffman_tree(null) {
+huffman_table::huffman_table(): huffman_tree(null), encodings(1), grafted(null), escape(0), own_nodes(0) {
 	for(int i = 0; i < 256; i++) {
+		encoding_slots[i] = 0;
 		decoding_lookup_table[i] = 0;
 	}
 }
 
-huffman_table::huffman_table(int* counts): huffman_table() {
+huffman_table::huffman_table(const int* counts): huffman_table() {
 	build(counts);
 }
 
 huffman_table::huffman_table(bitbuffer& buffer): huffman_table() {
-	huffman_tree = build_tree_from_buffer(buffer);
-	build_huffman_encoding_table();
-}
-
-huffman_table::~huffman_table() {
-	delete huffman_tree;
+	load_coding_tree(buffer);
 }
 
 huffman_table& huffman_table::operator=(huffman_table&& other) {
 	if(this != &other) {
 		// if this huffman tree is not null, it'll be cleaned up in other's destructor
+		// swapping the vectors keeps the nodes at the same addresses
+		std::swap(nodes, other.nodes);
 		std::swap(huffman_tree, other.huffman_tree);
+		std::swap(encodings, other.encodings);
+		std::swap(grafted, other.grafted);
+		std::swap(escape, other.escape);
+		std::swap(own_nodes, other.own_nodes);
 		// copy array contents
 		for(int i = 0; i < 256; i++) {
-			encoding_table[i] = other.encoding_table[i];
+			encoding_slots[i] = other.encoding_slots[i];
 			decoding_lookup_table[i] = other.decoding_lookup_table[i];
 		}
 	}
@@ -45,6 +47,10 @@ bool huffman_table::empty() {
 	return huffman_tree == null;
 }
 
+const tree_node* huffman_table::tree() {
+	return huffman_tree;
+}
+
 int huffman_table::get_type() {
 	return 0;
 }
@@ -52,15 +58,20 @@ int huffman_table::get_type() {
 void huffman_table::print_table() {
 	printf("Table:\n");
 	for(int i = 0; i < 256; i++) {
-		if(encoding_table[i].length) {
-			printf("%s %d ", charv(i).c_str(), encoding_table[i].length);
-			encoding_table[i].print();
+		if(encoding_slots[i]) {
+			encoding_descriptor& e = encodings[encoding_slots[i]];
+			printf("%s %d ", charv(i).c_str(), e.length);
+			e.print();
 			printf("\n");
 		}
 	}
 }
 
 void huffman_table::print_tree() {
+	if(huffman_tree == null) {
+		printf("graph G {\n}\n");
+		return;
+	}
 	huffman_tree->print();
 }
 
@@ -68,8 +79,39 @@ int huffman_table::print_tree(bool subgraph, int n, const std::string& label) {
 	return huffman_tree->print(subgraph, n, label);
 }
 
-encoding_descriptor& huffman_table::get_encoding(unsigned char, unsigned char c) {
-	return encoding_table[c];
+long long huffman_table::table_length() {
+	// see write_coding_tree, every node in the pool is part of the tree except for a grafted fallback,
+	// which is written as the escape leaf it replaced
+	long long bits = 0;
+	int n = grafted ? own_nodes : nodes.size();
+	for(int i = 0; i < n; i++) {
+		bits += nodes[i].is_internal ? 1 : 9;
+	}
+	return bits;
+}
+
+long long huffman_table::footprint(const int* counts) {
+	int symbols = 0;
+	for(int i = 0; i < 256; i++) {
+		if(counts[i]) {
+			symbols++;
+		}
+	}
+	return sizeof(huffman_table) + (symbols + 1) * sizeof(encoding_descriptor) +
+	       (2 * symbols + 1) * sizeof(tree_node);
+}
+
+encoding_descriptor& huffman_table::get_encoding(int, unsigned char c) {
+	return encodings[encoding_slots[c]];
+}
+
+void huffman_table::set_encoding(unsigned char c, const encoding_descriptor& descriptor) {
+	// symbols in the tree also appear in a grafted fallback, the shorter codeword wins
+	if(encoding_slots[c] && encodings[encoding_slots[c]].length < descriptor.length) {
+		return;
+	}
+	encoding_slots[c] = encodings.size();
+	encodings.push_back(descriptor);
 }
 
 /*
@@ -81,10 +123,30 @@ encoding_descriptor& huffman_table::get_encoding(unsigned char, unsigned char c)
  */
 
 void huffman_table::write_coding_tree(bitbuffer& buffer) {
-	write_coding_tree_traversal(huffman_tree, buffer);
+	if(huffman_tree == null) {
+		return;
+	}
+	// pre-order traversal with an explicit stack
+	const tree_node* stack[MAX_TREE_NODES];
+	int top = 0;
+	stack[top++] = huffman_tree;
+	while(top) {
+		const tree_node* node = stack[--top];
+		if(node == grafted) {
+			buffer.push_bits(1 << 8 | escape, 9);
+		} else if(node->is_internal) {
+			assert(node->left != null && node->right != null);
+			buffer.push_bit(0);
+			stack[top++] = node->right;
+			stack[top++] = node->left;
+		} else {
+			// leaf marker and value in one go
+			buffer.push_bits(1 << 8 | node->value, 9);
+		}
+	}
 }
 
-const tree_node* huffman_table::decoding_lookup(unsigned char, unsigned char c) {
+const tree_node* huffman_table::decoding_lookup(int, unsigned char c) {
 	return decoding_lookup_table[c];
 }
 
@@ -112,7 +174,7 @@ void huffman_table::build_huffman_encoding_table(tree_node* node, encoding_descr
 			decoding_lookup_table[descriptor.encoding[0]] = node;
 		}
 	} else {
-		encoding_table[node->value] = descriptor;
+		set_encoding(node->value, descriptor);
 		if(depth <= 8) {
 			unsigned char codeword = descriptor.encoding[0];
 			for(int i = 0; i < 1 << 8 - depth; i++) {
@@ -128,12 +190,24 @@ template<typename T> void swap(T& a, T& b) {
 	b = tmp;
 }
 
-void huffman_table::build(int* counts) {
+void huffman_table::build(const int* counts) {
 	// build huffman tree from the counts
 	min_pq<int, tree_node*> q;
+	int symbols = 0;
 	for(int i = 0; i < 256; i++) {
 		if(counts[i]) {
-			q.insert(counts[i], new tree_node { (unsigned char) i, counts[i] });
+			symbols++;
+		}
+	}
+	// 2n - 1 nodes plus two for the height 0 edge case, reserved up front so node pointers are
+	// stable
+	nodes.reserve(2 * symbols + 1);
+	// the empty codeword, and the height 0 edge case sets its symbol twice
+	encodings.reserve(symbols + 2);
+	for(int i = 0; i < 256; i++) {
+		if(counts[i]) {
+			nodes.emplace_back((unsigned char) i, counts[i]);
+			q.insert(counts[i], &nodes.back());
 		}
 	}
 	// if no character has counts, we're empty
@@ -147,15 +221,18 @@ void huffman_table::build(int* counts) {
 		if(a->height > b->height) {
 			swap(a, b);
 		}
-		q.insert(a->weight + b->weight, new tree_node { a, b });
+		nodes.emplace_back(a, b);
+		q.insert(a->weight + b->weight, &nodes.back());
 	}
 	huffman_tree = q.pop_min();
 	// edge case where the tree has height 0
 	if(!huffman_tree->is_internal) {
 		// TODO: weights?
 		// This is a hack to make encoding/decoding and tree serializing easy
-		huffman_tree->left  = new tree_node { huffman_tree->value, huffman_tree->weight };
-		huffman_tree->right = new tree_node { huffman_tree->value, huffman_tree->weight };
+		nodes.emplace_back(huffman_tree->value, huffman_tree->weight);
+		huffman_tree->left  = &nodes.back();
+		nodes.emplace_back(huffman_tree->value, huffman_tree->weight);
+		huffman_tree->right = &nodes.back();
 		// height will never be touched outside of this method but just in case
 		huffman_tree->height = 1;
 		huffman_tree->is_internal = true;
@@ -163,26 +240,131 @@ void huffman_table::build(int* counts) {
 	build_huffman_encoding_table();
 }
 
-tree_node* huffman_table::build_tree_from_buffer(bitbuffer& buffer) {
-	if(buffer.pop_bit()) {
-		return new tree_node(buffer.pop_byte(), 0);
-	} else {
-		return new tree_node(build_tree_from_buffer(buffer), build_tree_from_buffer(buffer));
+void huffman_table::graft(unsigned char escape, const huffman_table& fallback) {
+	assert(huffman_tree != null && grafted == null);
+	// find the escape leaf's parent, the root is always internal
+	tree_node* parent = null;
+	for(tree_node& node : nodes) {
+		if(node.is_internal && (!node.left->is_internal && node.left->value == escape ||
+		                        !node.right->is_internal && node.right->value == escape)) {
+			parent = &node;
+			break;
+		}
+	}
+	int fallback_depth = 0;
+	for(const encoding_descriptor& e : fallback.encodings) {
+		fallback_depth = std::max(fallback_depth, e.length);
 	}
+	tree_node* leaf = parent == null ? null : !parent->left->is_internal && parent->left->value == escape ?
+	                  parent->left : parent->right;
+	// only a corrupt table can get here, built trees are far shallower than this
+	if(leaf == null || leaf->depth + fallback_depth > MAX_CODE_LENGTH) {
+		eprintf("Error: Encoding table appears corrupt.\n");
+		exit(1);
+	}
+	// copy both trees into one pool and rebase the pointers
+	std::vector<tree_node> pool;
+	pool.reserve(nodes.size() + fallback.nodes.size());
+	pool.insert(pool.end(), nodes.begin(), nodes.end());
+	pool.insert(pool.end(), fallback.nodes.begin(), fallback.nodes.end());
+	own_nodes = nodes.size();
+	auto rebase = [&](tree_node* p) -> tree_node* {
+		if(p == null) return null;
+		if(p >= nodes.data() && p < nodes.data() + nodes.size()) return &pool[p - nodes.data()];
+		return &pool[own_nodes + (p - fallback.nodes.data())];
+	};
+	for(tree_node& node : pool) {
+		node.left = rebase(node.left);
+		node.right = rebase(node.right);
+	}
+	grafted = rebase(fallback.huffman_tree);
+	tree_node* p = rebase(parent);
+	(p->left == rebase(leaf) ? p->left : p->right) = grafted;
+	huffman_tree = rebase(huffman_tree);
+	nodes.swap(pool);
+	this->escape = escape;
+	// codewords and lookups start over from the grafted tree
+	encodings.resize(1);
+	for(int i = 0; i < 256; i++) {
+		encoding_slots[i] = 0;
+		decoding_lookup_table[i] = null;
+	}
+	build_huffman_encoding_table();
 }
 
-void huffman_table::write_coding_tree_traversal(tree_node* node, bitbuffer& buffer) {
-	if(node == null) {
-		return;
+void huffman_table::load_coding_tree(bitbuffer& buffer) {
+	// Parses the tree and fills the encoding and decoding lookup tables in a single pre-order pass
+	// without recursion. Nodes are parsed into a scratch pool and then moved into one exactly sized
+	// allocation.
+	tree_node scratch[MAX_TREE_NODES];
+	// internal nodes still waiting for their right subtree
+	tree_node* pending[MAX_CODE_LENGTH + 1];
+	int count = 0;
+	int top = 0;
+	tree_node* parent = null;
+	encoding_descriptor descriptor;
+	do {
+		if(count == MAX_TREE_NODES || descriptor.length > MAX_CODE_LENGTH) {
+			eprintf("Error: Encoding table appears corrupt.\n");
+			exit(1);
+		}
+		tree_node* node = &scratch[count++];
+		node->depth = descriptor.length;
+		if(parent != null) {
+			// attach to the parent, left first
+			if(parent->left == null) {
+				parent->left = node;
+			} else {
+				parent->right = node;
+			}
+		}
+		if(buffer.pop_bit()) {
+			if(node->depth == 0) {
+				// the root must be internal, see the height 0 edge case in build
+				eprintf("Error: Encoding table appears corrupt.\n");
+				exit(1);
+			}
+			node->value = buffer.pop_byte();
+			set_encoding(node->value, descriptor);
+			if(node->depth <= 8) {
+				unsigned char codeword = descriptor.encoding[0];
+				for(int i = 0; i < 1 << 8 - node->depth; i++) {
+					decoding_lookup_table[codeword + i] = node;
+				}
+			}
+			// climb to the closest ancestor without a right subtree
+			while(descriptor.length > 0 && descriptor.encoding[(descriptor.length - 1) / 8] >>
+					(7 - (descriptor.length - 1) % 8) & 1) {
+				descriptor.pop_bit();
+			}
+			if(descriptor.length > 0) {
+				descriptor.pop_bit();
+				descriptor.push_bit(1);
+				parent = pending[--top];
+			} else {
+				parent = null;
+			}
+		} else {
+			node->is_internal = true;
+			if(node->depth == 8) {
+				decoding_lookup_table[descriptor.encoding[0]] = node;
+			}
+			pending[top++] = node;
+			parent = node;
+			descriptor.push_bit(0);
+		}
+	} while(parent != null);
+	// move into the table's pool and rebase the pointers
+	nodes.assign(scratch, scratch + count);
+	auto rebase = [&](tree_node* p) {
+		return p == null ? null : &nodes[p - scratch];
+	};
+	for(tree_node& node : nodes) {
+		node.left = rebase(node.left);
+		node.right = rebase(node.right);
 	}
-	if(node->is_internal) {
-		buffer.push_bit(0);
-	} else {
-		buffer.push_bit(1);
-		buffer.push_byte(node->value);
+	for(int i = 0; i < 256; i++) {
+		decoding_lookup_table[i] = rebase(decoding_lookup_table[i]);
 	}
-	if(node->left == null || node->right == null)
-		assert(node->left == null && node->right == null);
-	write_coding_tree_traversal(node->left, buffer);
-	write_coding_tree_traversal(node->right, buffer);
+	huffman_tree = &nodes[0];
 }
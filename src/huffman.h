@@ -1,37 +1,62 @@
 #ifndef HUFFMAN_H
 #define HUFFMAN_H
 
+#include <vector>
+
 #include "bitbuffer.h"
 #include "coding.h"
 #include "tree.h"
 
-class huffman_table: public i_coding_provider {
+// A huffman tree has at most 256 leaves and 255 internal nodes
+#define MAX_TREE_NODES 511
+
+class huffman_table final: public i_coding_provider {
+	// all of the tree's nodes live in one allocation
+	std::vector<tree_node> nodes;
 	tree_node* huffman_tree;
-	encoding_descriptor encoding_table[256];
+	// codewords are only stored for symbols in the tree, slot 0 holds the empty codeword every other
+	// symbol maps to
+	std::vector<encoding_descriptor> encodings;
+	unsigned short encoding_slots[256];
 	tree_node* decoding_lookup_table[256];
+	// root of the copy of the fallback tree standing in for the escape symbol's leaf, see graft
+	tree_node* grafted;
+	unsigned char escape;
+	// nodes of the tree itself, the grafted copy follows them in the pool
+	int own_nodes;
 public:
 	huffman_table();
-	huffman_table(int* counts);
+	huffman_table(const int* counts);
 	huffman_table(bitbuffer& buffer);
-	~huffman_table() override;
 	huffman_table(const huffman_table& other) = delete;
 	huffman_table& operator=(const huffman_table& other) = delete;
 	huffman_table(huffman_table&& other) = delete;
 	huffman_table& operator=(huffman_table&& other);
 	bool empty();
+	// root of the tree, null while the table is empty
+	const tree_node* tree();
 	int get_type() override;
 	void print_table() override;
 	void print_tree() override;
+	long long table_length() override;
 	int print_tree(bool subgraph, int n, const std::string& label);
-	encoding_descriptor& get_encoding(unsigned char prev, unsigned char c) override;
-	const tree_node* decoding_lookup(unsigned char prev, unsigned char c) override;
+	encoding_descriptor& get_encoding(int prev, unsigned char c) override;
+	const tree_node* decoding_lookup(int prev, unsigned char c) override;
 	void write_coding_tree(bitbuffer& buffer) override;
+	// estimated bytes held by a table built from the counts
+	static long long footprint(const int* counts);
+	// builds the table from counts, the table must be empty
+	void build(const int* counts);
+	// Replaces the escape symbol's leaf with a copy of the fallback's tree so symbols which aren't in
+	// this table get the escape codeword followed by their fallback codeword. The escape symbol must
+	// be a leaf of the tree and the fallback must have every symbol. The table is still written
+	// without the fallback, with the escape as a plain leaf.
+	void graft(unsigned char escape, const huffman_table& fallback);
 private:
+	void set_encoding(unsigned char c, const encoding_descriptor& descriptor);
 	void build_huffman_encoding_table();
 	void build_huffman_encoding_table(tree_node* node, encoding_descriptor& descriptor, int depth);
-	void build(int* counts);
-	tree_node* build_tree_from_buffer(bitbuffer& buffer);
-	void write_coding_tree_traversal(tree_node* node, bitbuffer& buffer);
+	void load_coding_tree(bitbuffer& buffer);
 };
 
 #endif
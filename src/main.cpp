@@ -1,41 +1,228 @@
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <functional>
+#include <string>
+#include <vector>
 
 #include "bitbuffer.h"
 #include "coding.h"
+#include "column_huffman.h"
+#include "counting.h"
+#include "daemon.h"
+#include "escaped.h"
 #include "huffman.h"
 #include "markov_huffman.h"
+#include "parallel.h"
+#include "stored.h"
+#include "search.h"
+#include "stream.h"
+#include "training.h"
+#include "transform.h"
 #include "utils.h"
-
-#undef BUFFER_SIZE // previously defined in bitbuffer.h
-#define BUFFER_SIZE 32768
+#include "verify.h"
+#include "wide_huffman.h"
 
 void print_help() {
 	eprintf("markov-huffman <input> [-o output] [options]\n");
 	eprintf("\t-o output_file\n");
 	eprintf("\t-h use simple huffman coding\n");
+	eprintf("\t-c columns use column-aware coding for the first n fields of delimited records\n");
+	eprintf("\t-s separators field separators for column-aware coding (default \",\\t|\")\n");
+	eprintf("\t-r percent build the encoding table from a sample of the input\n");
+	eprintf("\t-m megabytes cap peak memory, falling back to smaller models if the table won't fit,\n"
+	        "\t   and report peak memory\n");
+	eprintf("\t-p contexts code symbol pairs with one lookup in the n hottest contexts (markov-huffman)\n");
+	eprintf("\t-w code 16-bit symbols (little-endian byte pairs) with an order-0 table, for UTF-16 text\n"
+	        "\t   and word-oriented binary data\n");
+	eprintf("\t-k give every Markov-Huffman context an escape to an order-0 table so a table built\n"
+	        "\t   from one input can code any other, use -k with -e for such a table too\n");
+	eprintf("\t-j threads number of threads used to build the tables and extract (default: one per core)\n");
+	eprintf("\t-t transform transform fixed-width numeric input before coding, one of delta:W, planes:W\n"
+	        "\t   or delta+planes:W for little-endian elements of W = 1, 2, 4 or 8 bytes, extraction\n"
+	        "\t   undoes it\n");
+	eprintf("\t-a pick whichever of simple huffman, markov-huffman (or column) and stored coding is\n"
+	        "\t   estimated to be smallest\n");
 	eprintf("\n");
 	eprintf("\t-e encoding_file\n");
 	eprintf("\t-d output_encoding_file\n");
 	eprintf("\n");
 	eprintf("\t-g print huffman trees and tables\n");
 	eprintf("\t-x extract\n");
+	eprintf("\t-i stream input from stdin instead of an input file, requires -e\n");
+	eprintf("\t-u write the output with direct I/O (O_DIRECT), bypassing the page cache\n");
+	eprintf("\n");
+	eprintf("markov-huffman train <directory> -d output_encoding_file [-h | -k | -w | -c columns [-s separators]]\n"
+	        "    [-j threads]\n");
+	eprintf("\tbuilds an encoding table from every file under the directory\n");
+	eprintf("\n");
+	eprintf("markov-huffman append <input> -o compressed_file -e encoding_file\n");
+	eprintf("\tcodes the input onto the end of a compressed file without re-encoding it\n");
+	eprintf("\n");
+	eprintf("markov-huffman grep <pattern> <input> -e encoding_file [-q] [-j threads]\n");
+	eprintf("\tprints the lines of a compressed file containing a literal pattern with their byte offsets\n"
+	        "\t(like grep -bF) without extracting it\n");
+	eprintf("\t-q print nothing and stop at the first match, the exit status tells whether there is one\n");
+	eprintf("\n");
+	eprintf("markov-huffman verify <input>... -e encoding_file [-q] [-j threads]\n");
+	eprintf("\tchecks that compressed files decode cleanly without writing anything, in parallel, and\n"
+	        "\tprints ok or the error for each\n");
+	eprintf("\t-q only print the files which fail\n");
+	eprintf("\n");
+	eprintf("markov-huffman -l socket [-j workers]\n");
+	eprintf("\t-l socket serve compress/extract requests on a Unix socket, see daemon.h\n");
+}
+
+const char* coder_names[] = { "simple Huffman", "Markov-Huffman", "column Markov-Huffman", "stored",
+                              "escaped Markov-Huffman", "wide Huffman" };
+
+// number of contexts a coder type counts symbols in, wide coding counts byte pairs by their high byte
+// and lone final bytes in one more context, see wide_huffman.h
+int count_contexts(int type, const field_tracker& fields) {
+	return type == 1 || type == 4 ? 256 : type == 2 ? fields.models() * 256 : type == 5 ? 257 : 1;
+}
+
+i_coding_provider* build_coder(int type, const context_counts& counts, const field_tracker& fields) {
+	if(type == 0) {
+		const int* row = counts.find(0);
+		return row ? new huffman_table(row) : new huffman_table();
+	} else if(type == 1) {
+		return new markov_huffman_table(counts);
+	} else if(type == 2) {
+		return new column_huffman_table(counts, fields);
+	} else if(type == 4) {
+		return new escaped_huffman_table(counts);
+	} else if(type == 5) {
+		return new wide_huffman_table(counts);
+	} else {
+		return new stored_table();
+	}
+}
+
+// Estimated bytes a coder built from the counts adds. Smoothing populates every context so smoothed
+// counts are estimated as full and include the rows smoothing allocates.
+long long coder_footprint(int type, const context_counts& counts, const field_tracker& fields,
+		bool smoothed) {
+	if(type == 3) {
+		return sizeof(stored_table);
+	}
+	if(type == 4) {
+		// escapes take care of unseen symbols so escaped counts are never smoothed
+		return escaped_huffman_table::footprint(counts);
+	}
+	if(type == 5) {
+		return wide_huffman_table::footprint(counts);
+	}
+	int contexts = count_contexts(type, fields);
+	long long bytes = type == 2 ? sizeof(column_huffman_table) + fields.models() * sizeof(markov_huffman_table) :
+	                  type == 1 ? sizeof(markov_huffman_table) : 0;
+	int full[256];
+	for(int c = 0; c < 256; c++) {
+		full[c] = 1;
+	}
+	for(int context = 0; context < contexts; context++) {
+		const int* row = smoothed ? full : counts.find(context);
+		if(row) {
+			bytes += huffman_table::footprint(row);
+		}
+	}
+	if(smoothed) {
+		bytes += (long long) (contexts - counts.populated()) * 256 * sizeof(int);
+	}
+	return bytes;
 }
 
-void construct_table(FILE* input_fd, std::function<void(unsigned char, unsigned char)> counter) {
-	size_t bytes_read;
-	unsigned char buffer[BUFFER_SIZE];
-	int prev = ' ';
-	while(bytes_read = read_buffer(buffer, 1, BUFFER_SIZE, input_fd)) {
-		for(int i = 0; i < bytes_read; i++) {
-			counter(prev, buffer[i]);
-			prev = buffer[i];
+// Sums the counts of a richer model over the context a simpler model doesn't distinguish, e.g.
+// column counts over the field to get markov-huffman counts. Reducing to the same type copies.
+context_counts* reduce_counts(context_counts& counts, int from, int to, const field_tracker& fields) {
+	int n = count_contexts(to, fields);
+	context_counts* reduced = new context_counts(n);
+	for(int context = 0; context < count_contexts(from, fields); context++) {
+		if(const int* row = counts.find(context)) {
+			int* reduced_row = reduced->row(context % n);
+			for(int c = 0; c < 256; c++) {
+				reduced_row[c] += row[c];
+			}
 		}
 	}
+	return reduced;
+}
+
+// Picks the coder type with the smallest estimated output (header, data and table) from the counts
+// of a richer model. The data length is computed from the counts and each candidate's codeword
+// lengths so nothing is trial encoded. For a sample, scale extrapolates the data length to the whole
+// input and candidates are built from smoothed counts like the final table will be. Candidates
+// which would take more than budget bytes of memory are skipped.
+int select_type(int type, context_counts& counts, const field_tracker& fields, bool sampled,
+		double scale, long long budget) {
+	int candidates[] = { 0, 1, type, 3 };
+	int best = -1;
+	long long best_size = 0;
+	for(int i = 0; i < 4; i++) {
+		int candidate = candidates[i];
+		// the column candidate is only there if column counts were taken
+		if(i == 2 && type != 2) continue;
+		context_counts* reduced = reduce_counts(counts, type, candidate, fields);
+		if(coder_footprint(candidate, *reduced, fields, sampled) > budget) {
+			eprintf("\t%-22s over the memory cap\n", coder_names[candidate]);
+		} else {
+			context_counts* smoothed = reduce_counts(*reduced, candidate, candidate, fields);
+			if(sampled) {
+				smooth_counts(*smoothed);
+			}
+			i_coding_provider* coder = build_coder(candidate, *smoothed, fields);
+			long long data = coder->coded_length(*reduced) * scale;
+			long long table = (coder->table_length() + 7) / 8;
+			long long size = i_coding_provider::header_length(candidate) + (data + 7) / 8 + table;
+			eprintf("\t%-22s ~%lld bytes + %lld byte table\n", coder_names[candidate], size - table, table);
+			if(best == -1 || size < best_size) {
+				best = candidate;
+				best_size = size;
+			}
+			delete coder;
+			delete smoothed;
+		}
+		delete reduced;
+	}
+	return best;
+}
+
+// Exits unless every option given (their letters) is one the mode takes.
+void check_options(const std::string& given, const char* allowed, const char* mode) {
+	for(char option : given) {
+		if(strchr(allowed, option) == null) {
+			std::string list;
+			for(const char* c = allowed; *c; c++) {
+				list += std::string(c == allowed ? "" : c[1] ? ", " : " and ") + "-" + *c;
+			}
+			eprintf("Error: %s only takes %s.\n", mode, list.c_str());
+			exit(1);
+		}
+	}
+}
+
+// reads an encoding table of a coder type, see i_coding_provider::load
+i_coding_provider* load_coder(int type, const char* encoding_input) {
+	FILE* encoding_input_fd = fopen(encoding_input, "rb");
+	if(encoding_input_fd == null) {
+		eprintf("Error while opening encoding input; %s.\n", strerror(errno));
+		exit(1);
+	}
+	return i_coding_provider::load(type, encoding_input_fd);
+}
+
+// reads the encoding table of a compressed file, which knows what it was encoded with
+// the file position is restored
+i_coding_provider* load_coder_for(FILE* compressed_fd, const char* encoding_input) {
+	int type = i_coding_provider::peek_type(compressed_fd);
+	if(type == -1) {
+		eprintf("Error while decoding file: Input appears corrupt.\n");
+		exit(1);
+	}
+	return load_coder(type, encoding_input);
 }
 
 int main(int argc, char* argv[]) {
@@ -47,15 +234,44 @@ int main(int argc, char* argv[]) {
 	bool extract = false;
 	bool debug = false;
 	bool simple_huffman = false;
+	bool auto_select = false;
+	// inputs which can't be seeked (stdin) are streamed, which requires an existing table
+	bool streaming = false;
+	bool direct_output = false;
+	bool escapes = false;
+	bool wide = false;
+	int columns = 0;
+	double sample_rate = 0;
+	long long memory_cap = 0;
+	int pair_contexts = 0;
+	// see transform.h
+	int transform = 0;
+	int threads = parallel_threads;
+	std::string separators = ",\t|";
 	char* input = null;
 	char* output = null;
 	char* encoding_input = null;
 	char* encoding_output = null;
+	char* socket_path = null;
+	// train builds a table from a directory of samples instead of compressing
+	bool training = argc > 1 && strcmp(argv[1], "train") == 0;
+	// grep searches a compressed file for a pattern without extracting it
+	bool searching = argc > 1 && strcmp(argv[1], "grep") == 0;
+	// append codes an input onto the end of an existing compressed file
+	bool appending = argc > 1 && strcmp(argv[1], "append") == 0;
+	// verify decodes compressed files without output to check they're intact
+	bool verifying = argc > 1 && strcmp(argv[1], "verify") == 0;
+	std::vector<const char*> inputs;
+	bool quiet = false;
+	const char* pattern = null;
+	// letters of the options given, for the modes which only take some
+	std::string given;
 	// Process arguments
-	for(int i = 1; i < argc; i++) {
+	for(int i = training || searching || appending || verifying ? 2 : 1; i < argc; i++) {
 		if(argv[i][0] == '-') {
 			int chomp = 0;
-			for(int j = 0; argv[i][++j] != 0x0; )
+			for(int j = 0; argv[i][++j] != 0x0; ) {
+				given += argv[i][j];
 				switch(argv[i][j]) {
 					case 'o':
 						if(i + 1 < argc) {
@@ -78,21 +294,109 @@ int main(int argc, char* argv[]) {
 							eprintf("Error: Expected encoding output file following -d.\n");
 						}
 						break;
+					case 'c':
+						if(i + 1 < argc) {
+							const char* count = argv[i + chomp++ + 1];
+							char* end;
+							long n = strtol(count, &end, 10);
+							// anything but a whole number in range fails the check below
+							columns = *count && *end == 0 && n >= 0 && n <= MAX_COLUMNS ? n : -1;
+						} else {
+							eprintf("Error: Expected column count following -c.\n");
+						}
+						break;
+					case 's':
+						if(i + 1 < argc) {
+							separators = argv[i + chomp++ + 1];
+						} else {
+							eprintf("Error: Expected separators following -s.\n");
+						}
+						break;
+					case 'r':
+						if(i + 1 < argc) {
+							sample_rate = atof(argv[i + chomp++ + 1]);
+						} else {
+							eprintf("Error: Expected sample percentage following -r.\n");
+						}
+						break;
+					case 'm':
+						if(i + 1 < argc) {
+							memory_cap = atof(argv[i + chomp++ + 1]) * 1024 * 1024;
+						} else {
+							eprintf("Error: Expected megabytes following -m.\n");
+						}
+						break;
+					case 'p':
+						if(i + 1 < argc) {
+							pair_contexts = atoi(argv[i + chomp++ + 1]);
+						} else {
+							eprintf("Error: Expected context count following -p.\n");
+						}
+						break;
+					case 't':
+						if(i + 1 < argc) {
+							transform = transform_id(argv[i + chomp++ + 1]);
+							if(transform == -1) {
+								eprintf("Error: Unknown transform %s.\n", argv[i + chomp]);
+								exit(1);
+							}
+						} else {
+							eprintf("Error: Expected transform following -t.\n");
+						}
+						break;
+					case 'j':
+						if(i + 1 < argc) {
+							threads = atoi(argv[i + chomp++ + 1]);
+						} else {
+							eprintf("Error: Expected thread count following -j.\n");
+						}
+						break;
+					case 'l':
+						if(i + 1 < argc) {
+							socket_path = argv[i + chomp++ + 1];
+						} else {
+							eprintf("Error: Expected socket path following -l.\n");
+						}
+						break;
 					case 'x':
 						extract = true;
 						break;
+					case 'i':
+						streaming = true;
+						break;
+					case 'u':
+						direct_output = true;
+						break;
 					case 'h':
 						simple_huffman = true;
 						break;
+					case 'a':
+						auto_select = true;
+						break;
+					case 'k':
+						escapes = true;
+						break;
+					case 'w':
+						wide = true;
+						break;
 					case 'g':
 						debug = true;
 						break;
+					case 'q':
+						quiet = true;
+						break;
 					default:
 						eprintf("Warning: Unknown option %c.\n", argv[i][j]);
+						given.pop_back();
 				}
+			}
 			i += chomp;
 		} else {
-			if(input == null) {
+			if(searching && pattern == null) {
+				pattern = argv[i];
+			} else if(verifying) {
+				inputs.push_back(argv[i]);
+			} else if(input == null) {
 				input = argv[i];
 			} else {
 				eprintf("Warning: Unexpected positional argument %s.\n", argv[i]);
@@ -101,7 +405,54 @@ int main(int argc, char* argv[]) {
 	}
 
 	// argument validation
-	if(input == null) {
+	if(socket_path) {
+		if(input) {
+			eprintf("Error: Daemon mode takes its files from requests, only provide -l and -j.\n");
+			exit(1);
+		}
+		check_options(given, "lj", "Daemon mode");
+		if(threads < 1) {
+			eprintf("Error: Thread count must be at least 1.\n");
+			exit(1);
+		}
+		serve(socket_path, threads);
+		return 0;
+	}
+	if(training) {
+		if(input == null || encoding_output == null) {
+			eprintf("Error: Training needs a directory and an encoding output (-d).\n");
+			exit(1);
+		}
+		check_options(given, "dhcskwgj", "Training");
+	}
+	if(searching) {
+		if(pattern == null || input == null || encoding_input == null) {
+			eprintf("Error: Searching needs a pattern, a compressed file and its encoding table (-e).\n");
+			exit(1);
+		}
+		check_options(given, "eqj", "Searching");
+		if(strchr(pattern, '\n')) {
+			eprintf("Error: Patterns match within a line and can't contain a newline.\n");
+			exit(1);
+		}
+	} else if(appending) {
+		if(input == null || output == null || encoding_input == null) {
+			eprintf("Error: Appending needs an input, the compressed file to extend (-o) and its encoding "
+			        "table (-e).\n");
+			exit(1);
+		}
+		check_options(given, "oej", "Appending");
+	} else if(verifying) {
+		if(inputs.empty() || encoding_input == null) {
+			eprintf("Error: Verifying needs compressed files and their encoding table (-e).\n");
+			exit(1);
+		}
+		check_options(given, "eqj", "Verifying");
+	} else if(quiet) {
+		eprintf("Error: -q only applies to grep and verify.\n");
+		exit(1);
+	}
+	if(input == null && !streaming && !verifying) {
 		eprintf("Error: Must provide input file.\n");
 		exit(1);
 	}
@@ -113,14 +464,166 @@ int main(int argc, char* argv[]) {
 		eprintf("Error: Must provide encoding file input while in decompress mode.\n");
 		exit(1);
 	}
+	if(streaming && input) {
+		eprintf("Error: Don't provide an input file while streaming from stdin.\n");
+		exit(1);
+	}
+	if(direct_output && (streaming || output == null)) {
+		eprintf("Error: Direct output needs an output file and can't be used while streaming.\n");
+		exit(1);
+	}
+	if(transform && (extract || streaming)) {
+		eprintf("Error: Transforms only apply to compressing files, extraction reads the transform from "
+		        "the file.\n");
+		exit(1);
+	}
+	if(streaming && !encoding_input) {
+		eprintf("Error: Must provide encoding file input while streaming from stdin.\n");
+		exit(1);
+	}
+	if(columns && simple_huffman) {
+		eprintf("Error: Column-aware coding can't be used with simple huffman coding.\n");
+		exit(1);
+	}
+	if(escapes && (simple_huffman || columns || auto_select)) {
+		eprintf("Error: Escapes only apply to Markov-Huffman coding, don't combine -k with -h, -c or -a.\n");
+		exit(1);
+	}
+	if(wide && (simple_huffman || columns || escapes || auto_select)) {
+		eprintf("Error: Wide coding is its own coder, don't combine -w with -h, -c, -k or -a.\n");
+		exit(1);
+	}
+	if(wide && streaming) {
+		eprintf("Error: Wide coding can't be streamed.\n");
+		exit(1);
+	}
+	if(auto_select && simple_huffman) {
+		eprintf("Error: Don't provide -h with -a, automatic selection already considers simple huffman "
+				"coding.\n");
+		exit(1);
+	}
+	if(auto_select && encoding_input && !extract) {
+		eprintf("Error: Automatic selection builds its own encoding table, don't provide one.\n");
+		exit(1);
+	}
+	if(sample_rate < 0 || sample_rate > 100) {
+		eprintf("Error: Sample percentage must be between 0 and 100.\n");
+		exit(1);
+	}
+	if(pair_contexts < 0 || pair_contexts > 256) {
+		eprintf("Error: Pair context count must be between 0 and 256 (0 turns pairs off).\n");
+		exit(1);
+	}
+	if(threads < 1) {
+		eprintf("Error: Thread count must be at least 1.\n");
+		exit(1);
+	}
+	// the shared pool is sized on first use, which comes after this
+	parallel_threads = threads;
+	if(memory_cap < 0) {
+		eprintf("Error: Memory cap must be positive.\n");
+		exit(1);
+	}
+	if(given.find('c') != std::string::npos && (columns < 1 || columns > MAX_COLUMNS)) {
+		eprintf("Error: Column count must be between 1 and %d.\n", MAX_COLUMNS);
+		exit(1);
+	}
+	if(separators.size() > MAX_SEPARATORS) {
+		eprintf("Error: At most %d separators can be given.\n", MAX_SEPARATORS);
+		exit(1);
+	}
+	for(size_t i = 0; i < separators.size(); i++) {
+		if(separators.find(separators[i], i + 1) != std::string::npos) {
+			eprintf("Error: Each separator can only be given once.\n");
+			exit(1);
+		}
+	}
+
+	if(training) {
+		int type = simple_huffman ? 0 : columns ? 2 : escapes ? 4 : wide ? 5 : 1;
+		eprintf("Training %s encoding table on %s...\n", coder_names[type], input);
+		field_tracker fields(columns ? columns : 1, separators);
+		context_counts counts(count_contexts(type, fields));
+		long long files = 0;
+		long long bytes = count_directory(input, type, fields, counts, files);
+		eprintf("Counted %lld bytes in %lld files.\n", bytes, files);
+		// symbols which weren't in any sample need codewords too, escapes already take care of that
+		if(type != 4 && type != 5) {
+			smooth_counts(counts);
+		}
+		i_coding_provider* coder = build_coder(type, counts, fields);
+		if(debug) {
+			coder->print_table();
+			coder->print_tree();
+		}
+		FILE* encoding_output_fd = fopen(encoding_output, "wb");
+		eprintf("Writing encoding table to %s...\n", encoding_output);
+		if(encoding_output_fd == null) {
+			eprintf("Error while opening encoding file output; %s.\n", strerror(errno));
+			exit(1);
+		}
+		{
+			bitbuffer buffer(encoding_output_fd, bitbuffer::write);
+			coder->write_coding_tree(buffer);
+		}
+		delete coder;
+		eprintf("Done.\n");
+		return 0;
+	}
+
+	if(searching) {
+		check_access(input, false);
+		check_access(encoding_input, false);
+		FILE* input_fd = fopen(input, "rb");
+		if(input_fd == null) {
+			eprintf("Error while opening input; %s.\n", strerror(errno));
+			exit(1);
+		}
+		i_coding_provider* coder = load_coder_for(input_fd, encoding_input);
+		// input file descriptor ownership transferred into this function
+		long long matches = search(*coder, input_fd, pattern, quiet);
+		delete coder;
+		// like grep, no match is a failure
+		return matches ? 0 : 1;
+	}
+
+	if(verifying) {
+		check_access(encoding_input, false);
+		long long failed = verify(encoding_input, inputs, quiet);
+		eprintf("Verified %lld files, %lld failed.\n", (long long) inputs.size(), failed);
+		return failed ? 1 : 0;
+	}
+
+	if(appending) {
+		check_access(input, false);
+		check_access(encoding_input, false);
+		FILE* input_fd = fopen(input, "rb");
+		if(input_fd == null) {
+			eprintf("Error while opening input; %s.\n", strerror(errno));
+			exit(1);
+		}
+		// the file is extended in place
+		FILE* output_fd = fopen(output, "r+b");
+		if(output_fd == null) {
+			eprintf("Error while opening output; %s.\n", strerror(errno));
+			exit(1);
+		}
+		i_coding_provider* coder = load_coder_for(output_fd, encoding_input);
+		eprintf("Appending %s ===> %s...\n", input, output);
+		// file descriptor ownership transferred into this method
+		coder->append(input_fd, output_fd);
+		delete coder;
+		eprintf("Done.\n");
+		return 0;
+	}
 
 	// check access on inputs/outputs
-	                    check_access(input, false);
+	if(!streaming)      check_access(input, false);
 	if(output)          check_access(output, true);
 	if(encoding_input)  check_access(encoding_input, false);
 	if(encoding_output) check_access(encoding_output, false);
 
-	FILE* input_fd = fopen(input, "rb");
+	FILE* input_fd = streaming ? stdin : fopen(input, "rb");
 	if(input_fd == null) {
 		eprintf("Error while opening input; %s.\n", strerror(errno));
 		exit(1);
@@ -133,52 +636,148 @@ int main(int argc, char* argv[]) {
 		exit(1);
 	}
 
-	i_coding_provider* coder = null;
-	if(encoding_input) {
-		eprintf("Loading encoding table from file...\n");
-		// load encoding
-		FILE* encoding_input_fd = fopen(encoding_input, "rb");
-		if(encoding_input_fd == null) {
-			eprintf("Error while opening encoding input; %s.\n", strerror(errno));
+	// coder type, see i_coding_provider::get_type
+	int type = simple_huffman ? 0 : columns ? 2 : escapes ? 4 : wide ? 5 : 1;
+	// header bytes read from a streamed input
+	unsigned char prefix[2];
+	int prefix_length = 0;
+	if(extract && streaming) {
+		// the compressed file knows what it was encoded with
+		prefix_length = read_buffer(prefix, 1, 2, input_fd);
+		type = i_coding_provider::parse_header(prefix, prefix_length);
+		if(type == -1) {
+			eprintf("Error while decoding file: Input appears corrupt.\n");
 			exit(1);
 		}
-		bitbuffer buffer(encoding_input_fd, bitbuffer::read);
-		// check that the correct encoding file was provided for our operation
-		if(buffer.peek_bit() != !simple_huffman) {
-			assert(encoding_input);
-			eprintf("Error: Incorrect encoding table provided for current operation; "
-					"expected %s, found %s.\n",
-					simple_huffman ? "simple Huffman" : "Markov-Huffman",
-					buffer.peek_bit() ? "Markov-Huffman" : "simple Huffman");
+		if(i_coding_provider::header_transform(prefix, prefix_length)) {
+			eprintf("Error: Transformed files can't be extracted from a stream, provide the input "
+			        "file.\n");
 			exit(1);
 		}
-		if(buffer.peek_bit() == 0) {
-			// simple huffman
-			coder = new huffman_table(buffer);
-		} else {
-			// markov-huffman
-			coder = new markov_huffman_table(buffer);
+		if(type == 5) {
+			eprintf("Error: Wide coded files can't be extracted from a stream, provide the input "
+			        "file.\n");
+			exit(1);
 		}
+	}
+
+	i_coding_provider* coder = null;
+	if(encoding_input) {
+		eprintf("Loading encoding table from file...\n");
+		// a compressed file (unless it's streamed, see above) knows what it was encoded with
+		coder = extract && !streaming ? load_coder_for(input_fd, encoding_input) : load_coder(type, encoding_input);
 	} else {
 		// build encoding tables
-		if(simple_huffman) {
-			eprintf("Building simple Huffman encoding table from input...\n");
-			int counts[256];
-			memset(counts, 0, 256 * sizeof(int));
-			construct_table(input_fd, [&](unsigned char, unsigned char c) {
-				counts[c]++;
-			});
-			coder = new huffman_table(counts);
+		// automatic selection counts for the richest model and reduces the counts once a coder is
+		// picked
+		eprintf("%s %s encoding table from %s...\n", auto_select ? "Selecting" : "Building",
+				auto_select ? "an" : coder_names[type], sample_rate ? "a sample of the input" : "input");
+		field_tracker fields(columns ? columns : 1, separators);
+		context_counts* counts = new context_counts(count_contexts(type, fields));
+		symbol_counter counter;
+		int field = 0;
+		int pending = -1;
+		if(type == 0) {
+			counter = [&](unsigned char, unsigned char c) {
+				counts->add(0, c);
+			};
+		} else if(type == 1 || type == 4) {
+			counter = [&](unsigned char prev, unsigned char c) {
+				counts->add(prev, c);
+			};
+		} else if(type == 5) {
+			// the low byte of a pair waits for its high byte
+			counter = [&](unsigned char, unsigned char c) {
+				if(pending == -1) {
+					pending = c;
+				} else {
+					counts->add(c, pending);
+					pending = -1;
+				}
+			};
 		} else {
-			eprintf("Building Markov-Huffman encoding table from input...\n");
-			int* counts = new int[256 * 256];
-			memset(counts, 0, 256 * 256 * sizeof(int));
-			construct_table(input_fd, [&](unsigned char prev, unsigned char c) {
-				counts[256 * prev + c]++;
-			});
-			coder = new markov_huffman_table(counts);
-			delete[] counts;
+			counter = [&](unsigned char prev, unsigned char c) {
+				counts->add(256 * field + prev, c);
+				field = fields.next_field[field][c];
+			};
 		}
+		long long sampled = 0;
+		if(sample_rate) {
+			// pairs have to start on an even offset
+			sampled = construct_table_sampled(input_fd, sample_rate / 100, counter, transform, type == 5 ? 2 : 1);
+		} else {
+			construct_table(input_fd, counter, transform);
+		}
+		if(pending != -1) {
+			// odd length, the last byte is coded alone
+			counts->add(256, pending);
+		}
+		// with a memory cap, the tables get whatever the process hasn't used up so far
+		long long budget = memory_cap ? memory_cap - peak_memory() : LLONG_MAX;
+		if(auto_select) {
+			double scale = sampled ? (double) file_size(input_fd) / sampled : 1;
+			int selected = select_type(type, *counts, fields, sample_rate, scale, budget);
+			if(selected == -1) {
+				eprintf("Error: Memory cap is too low, %.2f MB are already in use.\n",
+						peak_memory() / 1048576.0);
+				exit(1);
+			}
+			eprintf("Selected %s coding.\n", coder_names[selected]);
+			context_counts* reduced = reduce_counts(*counts, type, selected, fields);
+			delete counts;
+			counts = reduced;
+			type = selected;
+		} else if(memory_cap) {
+			// fall back to smaller models until the table fits
+			while(coder_footprint(type, *counts, fields, sample_rate) > budget) {
+				// byte pair counts can't be reduced to byte counts
+				if(type == 0 || type == 5) {
+					eprintf("Error: Memory cap is too low, %.2f MB are already in use.\n",
+							peak_memory() / 1048576.0);
+					exit(1);
+				}
+				// escaped markov-huffman falls back to plain markov-huffman, the table only covers this
+				// input then
+				int smaller = type == 4 ? 1 : type - 1;
+				eprintf("Warning: The %s table doesn't fit in the memory cap, falling back to %s "
+						"coding.\n", coder_names[type], coder_names[smaller]);
+				context_counts* reduced = reduce_counts(*counts, type, smaller, fields);
+				delete counts;
+				counts = reduced;
+				type = smaller;
+			}
+		}
+		if(sample_rate && sampled == 0) {
+			// an empty input (or one too short to sample), there's no ratio to estimate
+			if(type != 4 && type != 5) {
+				smooth_counts(*counts);
+			}
+			coder = build_coder(type, *counts, fields);
+			eprintf("Sampled 0 of %lld bytes; nothing sampled to estimate the ratio from.\n",
+					file_size(input_fd));
+		} else if(sample_rate) {
+			// symbols outside of the sample need codewords too
+			context_counts* sample_counts = reduce_counts(*counts, type, type, fields);
+			// Compare against a table built from the exact counts of the sample to show what the
+			// smoothing costs. Both are measured on the sample, so this isn't the loss from counting
+			// only part of the input. The exact table is gone before the real one is built to keep
+			// peak memory down.
+			i_coding_provider* exact_coder = build_coder(type, *sample_counts, fields);
+			double exact_ratio = exact_coder->coded_length(*sample_counts) / (8.0 * sampled);
+			delete exact_coder;
+			if(type != 4 && type != 5) {
+				smooth_counts(*counts);
+			}
+			coder = build_coder(type, *counts, fields);
+			double ratio = coder->coded_length(*sample_counts) / (8.0 * sampled);
+			eprintf("Sampled %lld of %lld bytes; estimated ratio %.3f vs %.3f from the sample's exact "
+					"counts (%.1f%% smoothing overhead).\n", sampled, file_size(input_fd), ratio,
+					exact_ratio, 100 * (ratio - exact_ratio) / exact_ratio);
+			delete sample_counts;
+		} else {
+			coder = build_coder(type, *counts, fields);
+		}
+		delete counts;
 		// return pointer to beginning
 		fseek(input_fd, 0, SEEK_SET);
 	}
@@ -201,17 +800,37 @@ int main(int argc, char* argv[]) {
 		coder->write_coding_tree(buffer);
 	}
 
-	if(extract) {
+	if(streaming) {
+		eprintf("Streaming %s from stdin ===> %s...\n", extract ? "extraction" : "compression", output);
+		// output file descriptor ownership transferred into these functions
+		if(extract) {
+			stream_decompress(*coder, prefix, prefix_length, input_fd, output_fd);
+		} else {
+			stream_compress(*coder, input_fd, output_fd);
+		}
+	} else if(extract) {
 		eprintf("Extracting %s ===> %s...\n", input, output);
 		// file descriptor ownership transferred into this method
-		coder->decompress(input_fd, output_fd);
+		coder->decompress(input_fd, output_fd, direct_output);
 	} else {
 		eprintf("Compressing %s ===> %s...\n", input, output);
+		// pairs rely on the context being the previous symbol
+		if(pair_contexts && type != 1 && type != 4) {
+			eprintf("Warning: Pair coding only applies to Markov-Huffman coding, ignoring -p.\n");
+			pair_contexts = 0;
+		}
 		// file descriptor ownership transferred into this method
-		coder->compress(input_fd, output_fd);
+		if(transform) {
+			eprintf("Transforming the input with %s.\n", transform_name(transform).c_str());
+		}
+		coder->compress(input_fd, output_fd, pair_contexts, direct_output, transform);
 	}
 
 	delete coder;
+
+	if(memory_cap) {
+		eprintf("Peak memory: %.2f MB (cap %.2f MB).\n", peak_memory() / 1048576.0, memory_cap / 1048576.0);
+	}
 	
 	eprintf("Done.\n");
 }
@@ -1,15 +1,39 @@
 #include "markov_huffman.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "bitbuffer.h"
+#include "bitreader.h"
+#include "bytesink.h"
 #include "coding.h"
+#include "counting.h"
+#include "fused_decoder.h"
 #include "huffman.h"
+#include "parallel.h"
+#include "parallel_decoder.h"
 #include "tree.h"
+#include "utils.h"
 
-markov_huffman_table::markov_huffman_table(int* counts) {
+huffman_table markov_huffman_table::empty_table;
+
+markov_huffman_table::markov_huffman_table(const context_counts& counts, int base) {
+	// allocate every populated context's table up front, the builds are independent and each
+	// writes only its own table so the result doesn't depend on scheduling
+	const int* rows[256];
 	for(int i = 0; i < 256; i++) {
-		tables[i] = huffman_table(counts + 256 * i);
+		rows[i] = counts.find(base + i);
+		if(rows[i]) {
+			storage.emplace_back();
+			tables[i] = &storage.back();
+		} else {
+			tables[i] = &empty_table;
+		}
 	}
+	thread_pool::shared().parallel_for(256, [&](int i) {
+		if(rows[i]) {
+			tables[i]->build(rows[i]);
+		}
+	});
 }
 
 markov_huffman_table::markov_huffman_table(bitbuffer& buffer) {
@@ -18,9 +42,11 @@ markov_huffman_table::markov_huffman_table(bitbuffer& buffer) {
 	// load trees
 	for(int i = 0; i < 256; i++) {
 		if(buffer.pop_bit()) {
-			tables[i] = huffman_table(buffer);
+			storage.emplace_back(buffer);
+			tables[i] = &storage.back();
+		} else {
+			tables[i] = &empty_table;
 		}
-		// else: no action required
 	}
 }
 
@@ -30,9 +56,9 @@ int markov_huffman_table::get_type() {
 
 void markov_huffman_table::print_table() {
 	for(int i = 0; i < 256; i++) {
-		if(!tables[i].empty()) {
+		if(!tables[i]->empty()) {
 			printf("Prev '%s' table:\n", charv(i).c_str());
-			tables[i].print_table();
+			tables[i]->print_table();
 		}
 	}
 }
@@ -41,20 +67,55 @@ void markov_huffman_table::print_tree() {
 	printf("graph G {\n");
 	printf("\tpackmode=\"cluster\";\n");
 	for(int i = 0, n = 0; i < 256; i++) {
-		if(!tables[i].empty()) {
+		if(!tables[i]->empty()) {
 			printf("/* Prev '%s' tree: */\n", charv(i).c_str());
-			n = tables[i].print_tree(true, n, "Prev: " + charv(i));
+			n = tables[i]->print_tree(true, n, "Prev: " + charv(i));
 		}
 	}
 	printf("}\n");
 }
 
-encoding_descriptor& markov_huffman_table::get_encoding(unsigned char prev, unsigned char c) {
-	return tables[prev].get_encoding(prev, c);
+long long markov_huffman_table::table_length() {
+	// leading 1 and a presence bit per tree
+	long long bits = 1 + 256;
+	for(int i = 0; i < 256; i++) {
+		bits += tables[i]->table_length();
+	}
+	return bits;
+}
+
+encoding_descriptor& markov_huffman_table::get_encoding(int prev, unsigned char c) {
+	return tables[prev]->get_encoding(prev, c);
+}
+
+const tree_node* markov_huffman_table::decoding_lookup(int prev, unsigned char c) {
+	return tables[prev]->decoding_lookup(prev, c);
+}
+
+void markov_huffman_table::decode(FILE* input_fd, int header_length, long long size, long long length,
+                                  bytesink& output) {
+	if(parallel_threads > 1 && size > PARALLEL_DECODE_CHUNK) {
+		i_coding_provider::decode(input_fd, header_length, size, length, output);
+		return;
+	}
+	// the reader owns the input from here on
+	bitreader input_buffer(input_fd, size, length);
+	if(!decoder().decode(input_buffer, initial_context(), output)) {
+		eprintf("Error while decoding file: Input appears corrupt.\n");
+		exit(1);
+	}
+}
+
+bool markov_huffman_table::verify_data(bitreader& input_buffer, int& context) {
+	return decoder().verify(input_buffer, context);
 }
 
-const tree_node* markov_huffman_table::decoding_lookup(unsigned char prev, unsigned char c) {
-	return tables[prev].decoding_lookup(prev, c);
+const fused_decoder& markov_huffman_table::decoder() {
+	// verify calls this from several threads at once
+	std::call_once(fused_built, [this] {
+		fused.reset(new fused_decoder(tables));
+	});
+	return *fused;
 }
 
 /*
@@ -80,9 +141,9 @@ const tree_node* markov_huffman_table::decoding_lookup(unsigned char prev, unsig
 void markov_huffman_table::write_coding_tree(bitbuffer& buffer) {
 	buffer.push_bit(1);
 	for(int i = 0; i < 256; i++) {
-		buffer.push_bit(!tables[i].empty());
-		if(!tables[i].empty()) {
-			tables[i].write_coding_tree(buffer);
+		buffer.push_bit(!tables[i]->empty());
+		if(!tables[i]->empty()) {
+			tables[i]->write_coding_tree(buffer);
 		}
 	}
 }
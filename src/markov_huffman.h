@@ -1,15 +1,31 @@
 #ifndef MARKOV_HUFFMAN_H
 #define MARKOV_HUFFMAN_H
 
+#include <deque>
+#include <memory>
+#include <mutex>
+
 #include "bitbuffer.h"
 #include "coding.h"
+#include "counting.h"
+#include "fused_decoder.h"
 #include "huffman.h"
 #include "tree.h"
 
 class markov_huffman_table: public i_coding_provider {
-	huffman_table tables[256];
+	// only contexts with a tree are allocated, the rest share one empty table
+	// the deque keeps the tables in place as it grows
+	std::deque<huffman_table> storage;
+	huffman_table* tables[256];
+	static huffman_table empty_table;
+	// serial decoding goes through a fused_decoder built on first use, compressing doesn't need it
+	// and the tables don't change once built
+	std::unique_ptr<fused_decoder> fused;
+	std::once_flag fused_built;
 public:
-	markov_huffman_table(int* counts);
+	// builds the tables from contexts [base, base + 256) of the counts, in parallel on the shared
+	// thread pool
+	markov_huffman_table(const context_counts& counts, int base = 0);
 	markov_huffman_table(bitbuffer& buffer);
 	markov_huffman_table(const markov_huffman_table& other) = delete;
 	markov_huffman_table& operator=(const markov_huffman_table& other) = delete;
@@ -18,9 +34,15 @@ public:
 	int get_type() override;
 	void print_table() override;
 	void print_tree() override;
-	encoding_descriptor& get_encoding(unsigned char prev, unsigned char c) override;
-	const tree_node* decoding_lookup(unsigned char prev, unsigned char c) override;
+	long long table_length() override;
+	encoding_descriptor& get_encoding(int prev, unsigned char c) override;
+	const tree_node* decoding_lookup(int prev, unsigned char c) override;
 	void write_coding_tree(bitbuffer& buffer) override;
+private:
+	void decode(FILE* input_fd, int header_length, long long size, long long length,
+	            bytesink& output) override;
+	bool verify_data(bitreader& input_buffer, int& context) override;
+	const fused_decoder& decoder();
 };
 
 #endif
@@ -0,0 +1,52 @@
+#include "pairs.h"
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+
+#include "coding.h"
+#include "utils.h"
+
+// first n bits of a codeword, n <= 32
+static uint32_t leading_bits(const encoding_descriptor& e, int n) {
+	uint32_t bits = 0;
+	for(int j = 0; j < 4; j++) {
+		bits = bits << 8 | e.encoding[j];
+	}
+	return n ? bits >> (32 - n) : 0;
+}
+
+pair_table::pair_table(i_coding_provider& coder, const unsigned char* sample, int sample_length, int n) {
+	// rank contexts by how often they occur in the sample
+	int counts[256] = { 0 };
+	int context = coder.initial_context();
+	for(int i = 0; i < sample_length; i++) {
+		counts[context]++;
+		context = coder.next_context(context, sample[i]);
+	}
+	int order[256];
+	for(int i = 0; i < 256; i++) {
+		order[i] = i;
+		hot[i] = -1;
+	}
+	std::stable_sort(order, order + 256, [&](int a, int b) { return counts[a] > counts[b]; });
+	for(int h = 0; h < n && h < 256 && counts[order[h]]; h++) {
+		int prev = order[h];
+		hot[prev] = h;
+		first_rows.resize(256 * (h + 1), -1);
+		for(int c1 = 0; c1 < 256; c1++) {
+			encoding_descriptor& first = coder.get_encoding(prev, c1);
+			if(first.length == 0 || first.length >= MAX_PAIR_CODE_LENGTH) continue;
+			int r = codes.size() / 256;
+			first_rows[256 * h + c1] = r;
+			codes.resize(256 * (r + 1));
+			uint32_t first_bits = leading_bits(first, first.length);
+			for(int c2 = 0; c2 < 256; c2++) {
+				encoding_descriptor& second = coder.get_encoding(coder.next_context(prev, c1), c2);
+				int length = first.length + second.length;
+				if(second.length == 0 || length > MAX_PAIR_CODE_LENGTH) continue;
+				codes[256 * r + c2].bits = first_bits << second.length | leading_bits(second, second.length);
+				codes[256 * r + c2].length = length;
+			}
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef PAIRS_H
+#define PAIRS_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "coding.h"
+
+// Pairs whose concatenated codeword is longer than this are coded one symbol at a time
+#define MAX_PAIR_CODE_LENGTH 32
+
+struct pair_code {
+	uint32_t bits;
+	// 0 if the pair doesn't fit in MAX_PAIR_CODE_LENGTH bits
+	uint32_t length;
+};
+
+// Concatenated codewords of two symbols for the hottest contexts of a coder whose context is the
+// previous symbol (markov-huffman), so the encoder can emit two symbols with one lookup and one
+// append. Only first symbols in the hot contexts' trees get a row of 256 second symbols.
+class pair_table {
+	// hot index of each context, -1 if the context has no pairs
+	short hot[256];
+	// row of each (hot context, first symbol), -1 if the first symbol has no codeword
+	std::vector<int> first_rows;
+	std::vector<pair_code> codes;
+public:
+	// Builds pairs for the n contexts which occur most often in the sample
+	pair_table(i_coding_provider& coder, const unsigned char* sample, int sample_length, int n);
+	// returns the codes of (context, c1, c2) for every c2, or null if there are none
+	const pair_code* row(int context, unsigned char c1) const {
+		if(hot[context] == -1) return null;
+		int r = first_rows[256 * hot[context] + c1];
+		return r == -1 ? null : &codes[256 * r];
+	}
+};
+
+#endif
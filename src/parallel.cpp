@@ -0,0 +1,109 @@
+#include "parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+int parallel_threads = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+
+thread_pool::thread_pool(int threads): stopping(false) {
+	for(int i = 0; i < threads; i++) {
+		workers.emplace_back(&thread_pool::work, this);
+	}
+}
+
+thread_pool::~thread_pool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	ready.notify_all();
+	for(std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+int thread_pool::size() const {
+	return workers.size();
+}
+
+void thread_pool::submit(std::function<void()> task) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(std::move(task));
+	}
+	ready.notify_one();
+}
+
+void thread_pool::work() {
+	while(true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if(tasks.empty()) {
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+bool thread_pool::run_queued() {
+	std::function<void()> task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(tasks.empty()) {
+			return false;
+		}
+		task = std::move(tasks.front());
+		tasks.pop_front();
+	}
+	task();
+	return true;
+}
+
+void thread_pool::parallel_for(int n, const std::function<void(int)>& fn) {
+	int helpers = std::min(size(), n - 1);
+	if(helpers <= 0) {
+		for(int i = 0; i < n; i++) {
+			fn(i);
+		}
+		return;
+	}
+	std::atomic<int> next(0);
+	int running = helpers;
+	std::mutex done_mutex;
+	std::condition_variable done;
+	auto run = [&] {
+		for(int i; (i = next++) < n; ) {
+			fn(i);
+		}
+	};
+	for(int k = 0; k < helpers; k++) {
+		submit([&] {
+			run();
+			std::lock_guard<std::mutex> lock(done_mutex);
+			if(--running == 0) {
+				done.notify_one();
+			}
+		});
+	}
+	run();
+	// Helpers which haven't started yet find nothing left to do. Running them (and whatever else is
+	// queued) here rather than waiting for a worker keeps nested calls from deadlocking when every
+	// worker is waiting in one. Once the queue is empty, all of the helpers have been taken by
+	// threads which will finish them.
+	while(run_queued());
+	std::unique_lock<std::mutex> lock(done_mutex);
+	done.wait(lock, [&] { return running == 0; });
+}
+
+thread_pool& thread_pool::shared() {
+	static thread_pool pool(parallel_threads - 1);
+	return pool;
+}
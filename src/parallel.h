@@ -0,0 +1,44 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of threads parallel work is spread over, including the calling thread. Set before the
+// shared pool is first used.
+extern int parallel_threads;
+
+// A fixed set of worker threads running queued tasks.
+class thread_pool {
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable ready;
+	bool stopping;
+public:
+	thread_pool(int threads);
+	// runs the tasks still queued and joins the workers
+	~thread_pool();
+	thread_pool(const thread_pool& other) = delete;
+	thread_pool& operator=(const thread_pool& other) = delete;
+	int size() const;
+	void submit(std::function<void()> task);
+	// Runs fn(i) for every i in [0, n) on the workers and the calling thread and returns once all
+	// are done. Indices are handed out one at a time so uneven work balances, fn must be safe to
+	// call concurrently for different i. Once its own indices are handed out, the calling thread
+	// runs queued tasks until the queue is empty before it waits, so fn can call parallel_for from a
+	// worker without every worker ending up blocked on helpers nobody runs.
+	void parallel_for(int n, const std::function<void(int)>& fn);
+	// process-wide pool with parallel_threads - 1 workers
+	static thread_pool& shared();
+private:
+	void work();
+	// runs the task at the front of the queue, returns false if there was none
+	bool run_queued();
+};
+
+#endif
@@ -0,0 +1,140 @@
+#include "parallel_decoder.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "bytesink.h"
+#include "coding.h"
+#include "parallel.h"
+#include "tree.h"
+#include "utils.h"
+
+static void corrupt() {
+	eprintf("Error while decoding file: Input appears corrupt.\n");
+	exit(1);
+}
+
+parallel_decoder::parallel_decoder(i_coding_provider& coder): coder(coder), base(0) {}
+
+const tree_node* parallel_decoder::decode_symbol(int context, long long& p) const {
+	uint64_t word;
+	memcpy(&word, &data[(p >> 3) - base], 8);
+	uint64_t window = __builtin_bswap64(word) << (p & 7);
+	const tree_node* node = coder.decoding_lookup(context, window >> 56);
+	if(node == null) {
+		return null;
+	}
+	if(!node->is_internal) {
+		p += node->depth;
+		return node;
+	}
+	// codeword longer than 8 bits, walk the rest of the tree
+	p += 8;
+	do {
+		node = data[(p >> 3) - base] >> (7 - (p & 7)) & 1 ? node->right : node->left;
+		p++;
+	} while(node->is_internal);
+	return node;
+}
+
+void parallel_decoder::decode_chunk(chunk& c, bool exact) const {
+	c.output.clear();
+	c.records.clear();
+	c.failed = false;
+	long long p = c.start;
+	int context = c.context;
+	while(p < c.end) {
+		// an exact chunk started at a true boundary, there's nothing to synchronize with
+		if(!exact && c.records.size() < PARALLEL_DECODE_RECORDS) {
+			c.records.push_back({ p, context });
+		}
+		const tree_node* node = decode_symbol(context, p);
+		if(node == null) {
+			c.failed = true;
+			break;
+		}
+		c.output.push_back(node->value);
+		context = coder.next_context(context, node->value);
+	}
+	c.end_position = p;
+	c.end_context = context;
+}
+
+void parallel_decoder::decode(FILE* input_fd, int header_length, long long size, long long length,
+                              bytesink& output) {
+	const long long chunk_bits = (long long) PARALLEL_DECODE_CHUNK * 8;
+	long long chunks = (length + chunk_bits - 1) / chunk_bits;
+	std::vector<chunk> round(parallel_threads);
+	// true state at the start of the round
+	long long position = 0;
+	int context = coder.initial_context();
+	for(long long first = 0; first < chunks && !output.stopped(); first += parallel_threads) {
+		int n = chunks - first < parallel_threads ? chunks - first : parallel_threads;
+		long long end = (first + n) * chunk_bits < length ? (first + n) * chunk_bits : length;
+		// the last symbol can run up to a codeword past the end and symbols are read a word at a
+		// time, anything past the data reads as zeroes
+		base = position >> 3;
+		long long bytes = (end + 7) / 8 - base + (MAX_CODE_LENGTH + 7) / 8 + 8;
+		long long available = size - base < bytes ? size - base : bytes;
+		data.assign(bytes > 0 ? bytes : 0, 0);
+		if(available > 0 && read_at(data.data(), available, header_length + base, input_fd) != available) {
+			corrupt();
+		}
+		for(int k = 0; k < n; k++) {
+			chunk& c = round[k];
+			// the first chunk continues from the true state, the others guess
+			c.start = k == 0 ? position : (first + k) * chunk_bits;
+			c.end = (first + k + 1) * chunk_bits < length ? (first + k + 1) * chunk_bits : length;
+			c.context = k == 0 ? context : coder.initial_context();
+		}
+		thread_pool::shared().parallel_for(n, [&](int k) {
+			decode_chunk(round[k], k == 0);
+		});
+		for(int k = 0; k < n; k++) {
+			chunk& c = round[k];
+			if(k == 0) {
+				if(c.failed) {
+					corrupt();
+				}
+				output.push_bytes(c.output.data(), c.output.size());
+				position = c.end_position;
+				context = c.end_context;
+				continue;
+			}
+			// decode serially from the true state until it meets the speculative decoding
+			size_t j = 0;
+			while(true) {
+				while(j < c.records.size() && c.records[j].position < position) {
+					j++;
+				}
+				if(j < c.records.size() && c.records[j].position == position && c.records[j].context == context) {
+					// synchronized, the rest of the chunk's output is right
+					if(c.failed) {
+						corrupt();
+					}
+					output.push_bytes(c.output.data() + j, c.output.size() - j);
+					position = c.end_position;
+					context = c.end_context;
+					break;
+				}
+				if(position >= c.end) {
+					// never synchronized, the whole chunk was decoded serially
+					break;
+				}
+				const tree_node* node = decode_symbol(context, position);
+				if(node == null) {
+					corrupt();
+				}
+				output.push_bytes(&node->value, 1);
+				context = coder.next_context(context, node->value);
+			}
+		}
+	}
+	// the last codeword ran past the end of the data
+	if(position != length && !output.stopped()) {
+		corrupt();
+	}
+	fclose(input_fd);
+}
@@ -0,0 +1,65 @@
+#ifndef PARALLEL_DECODER_H
+#define PARALLEL_DECODER_H
+
+#include <stdio.h>
+#include <vector>
+
+#include "bytesink.h"
+#include "coding.h"
+#include "tree.h"
+
+// Compressed bytes each thread decodes at a time
+#define PARALLEL_DECODE_CHUNK (1 << 20)
+// Symbol boundaries kept from the start of each chunk to synchronize on, huffman codes typically
+// resynchronize within a few dozen symbols
+#define PARALLEL_DECODE_RECORDS 4096
+
+// Multi-threaded decoding of a single bitstream, needing nothing from the encoder.
+//
+// The data is cut into chunks at fixed bit offsets which are decoded speculatively on the shared
+// thread pool: each thread starts at the beginning of its chunk, which likely isn't a codeword
+// boundary, with a guessed context. Huffman codes are self-synchronizing, so a decoder which starts
+// in the wrong place soon lands on a true codeword boundary and from there on decodes exactly what
+// the true decoder would. Decoding only depends on the bit position and context, so once the true
+// decoding of the previous chunk reaches a (position, context) pair the speculative decoder went
+// through, the rest of the speculative output is known to be right. The chunks are stitched
+// together in order, decoding the few symbols before the synchronization point serially; a chunk
+// which never synchronizes (or hit a context without a table) is decoded serially in full so the
+// output is always exact.
+//
+// A round of one chunk per thread is held in memory at a time.
+class parallel_decoder {
+	struct record {
+		long long position;
+		int context;
+	};
+	struct chunk {
+		// bit range of the chunk, symbols starting in the range belong to it
+		long long start;
+		long long end;
+		int context;
+		std::vector<unsigned char> output;
+		// position and context before each of the first symbols
+		std::vector<record> records;
+		// state after the last symbol
+		long long end_position;
+		int end_context;
+		// a context without a table was reached, only possible with a wrong guess or corrupt data
+		bool failed;
+	};
+	i_coding_provider& coder;
+	// data of the current round starting at byte base
+	std::vector<unsigned char> data;
+	long long base;
+public:
+	parallel_decoder(i_coding_provider& coder);
+	// decodes length bits of data following a header of header_length bytes into output, the input
+	// is closed
+	void decode(FILE* input_fd, int header_length, long long size, long long length, bytesink& output);
+private:
+	// decodes the symbol at bit position p and moves past it, returns null if the context has no table
+	const tree_node* decode_symbol(int context, long long& p) const;
+	void decode_chunk(chunk& c, bool exact) const;
+};
+
+#endif
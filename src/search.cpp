@@ -0,0 +1,96 @@
+#include "search.h"
+#include <stdio.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+
+#include "bytesink.h"
+#include "coding.h"
+
+// Finds the lines containing the pattern in blocks of decoded data
+class line_matcher {
+	std::boyer_moore_horspool_searcher<std::string::const_iterator> searcher;
+	bool quiet;
+	// the partial line at the end of the last block
+	std::string pending;
+	// offset of pending in the decoded data
+	long long offset;
+public:
+	long long matches;
+	line_matcher(const std::string& pattern, bool quiet):
+		searcher(pattern.begin(), pattern.end()), quiet(quiet), offset(0), matches(0) {}
+	// returns false once there's no need to see more
+	bool feed(const unsigned char* data, size_t n);
+	void finish();
+private:
+	// scans whole lines starting at offset base
+	bool scan(const char* text, size_t n, long long base);
+};
+
+bool line_matcher::feed(const unsigned char* data, size_t n) {
+	const char* text = (const char*) data;
+	size_t complete = n;
+	while(complete > 0 && text[complete - 1] != '\n') {
+		complete--;
+	}
+	if(complete == 0) {
+		// no line ends in this block
+		pending.append(text, n);
+		return true;
+	}
+	bool more;
+	long long base = offset;
+	if(pending.empty()) {
+		more = scan(text, complete, base);
+		offset += complete;
+	} else {
+		pending.append(text, complete);
+		more = scan(pending.data(), pending.size(), base);
+		offset += pending.size();
+	}
+	pending.assign(text + complete, n - complete);
+	return more;
+}
+
+void line_matcher::finish() {
+	// the last line doesn't end with a newline
+	if(!pending.empty()) {
+		scan(pending.data(), pending.size(), offset);
+	}
+}
+
+bool line_matcher::scan(const char* text, size_t n, long long base) {
+	const char* end = text + n;
+	const char* p = text;
+	while(p < end) {
+		const char* match = std::search(p, end, searcher);
+		if(match == end) {
+			break;
+		}
+		const char* line = match;
+		while(line > p && line[-1] != '\n') {
+			line--;
+		}
+		const char* eol = std::find(match, end, '\n');
+		matches++;
+		if(quiet) {
+			return false;
+		}
+		printf("%lld:", base + (line - text));
+		fwrite(line, 1, eol - line, stdout);
+		putchar('\n');
+		p = eol + 1;
+	}
+	return true;
+}
+
+long long search(i_coding_provider& coder, FILE* input_fd, const std::string& pattern, bool quiet) {
+	line_matcher matcher(pattern, quiet);
+	coder.decompress(input_fd, [&](const unsigned char* data, size_t n) {
+		return matcher.feed(data, n);
+	});
+	if(!quiet || matcher.matches == 0) {
+		matcher.finish();
+	}
+	return matcher.matches;
+}
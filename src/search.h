@@ -0,0 +1,19 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdio.h>
+#include <string>
+
+#include "coding.h"
+
+// Searches a compressed file for a literal pattern without writing the decoded data anywhere. The
+// file is decoded block by block (in parallel for large files, see parallel_decoder.h) into a
+// buffer which is scanned with a Boyer-Moore-Horspool searcher, so memory doesn't depend on the
+// file size, only on the longest line.
+// Every line containing the pattern is printed to stdout as "offset:line", offset being the byte
+// offset of the line in the decoded data, like grep -bF prints it. Quiet prints nothing and stops
+// decoding at the first match.
+// Returns the number of matching lines. The input is closed.
+long long search(i_coding_provider& coder, FILE* input_fd, const std::string& pattern, bool quiet);
+
+#endif
@@ -0,0 +1,63 @@
+#include "stored.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bitbuffer.h"
+#include "coding.h"
+#include "tree.h"
+#include "utils.h"
+
+stored_table::stored_table() {
+	for(int i = 0; i < 256; i++) {
+		encoding_table[i].length = 8;
+		encoding_table[i].encoding[0] = i;
+		leaves[i].value = i;
+		leaves[i].depth = 8;
+	}
+}
+
+stored_table::stored_table(bitbuffer& buffer): stored_table() {
+	// pop leading indicator bit
+	buffer.pop_bit();
+	if(buffer.pop_byte() != get_type()) {
+		eprintf("Error: Encoding table is not a valid stored encoding table.\n");
+		exit(1);
+	}
+}
+
+int stored_table::get_type() {
+	return 3;
+}
+
+void stored_table::print_table() {
+	printf("Table:\n");
+	printf("(stored, every symbol is its own 8-bit codeword)\n");
+}
+
+void stored_table::print_tree() {
+	printf("graph G {\n}\n");
+}
+
+long long stored_table::table_length() {
+	return 9;
+}
+
+encoding_descriptor& stored_table::get_encoding(int, unsigned char c) {
+	return encoding_table[c];
+}
+
+const tree_node* stored_table::decoding_lookup(int, unsigned char c) {
+	return &leaves[c];
+}
+
+/*
+ * Output file format:
+ * Like markov-huffman files, stored tables start with a 1. The leading 1 is followed by the 8-bit
+ * coder type and nothing else.
+ *
+ */
+
+void stored_table::write_coding_tree(bitbuffer& buffer) {
+	buffer.push_bit(1);
+	buffer.push_byte(get_type());
+}
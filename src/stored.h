@@ -0,0 +1,30 @@
+#ifndef STORED_H
+#define STORED_H
+
+#include "bitbuffer.h"
+#include "coding.h"
+#include "tree.h"
+
+// Stores symbols as-is, every codeword is the symbol's own 8 bits. Used when coding would make the
+// output bigger than the input (tiny or high-entropy inputs).
+class stored_table: public i_coding_provider {
+	encoding_descriptor encoding_table[256];
+	// every lookup resolves to a depth 8 leaf
+	tree_node leaves[256];
+public:
+	stored_table();
+	stored_table(bitbuffer& buffer);
+	stored_table(const stored_table& other) = delete;
+	stored_table& operator=(const stored_table& other) = delete;
+	stored_table(stored_table&& other) = delete;
+	stored_table& operator=(stored_table&& other) = delete;
+	int get_type() override;
+	void print_table() override;
+	void print_tree() override;
+	long long table_length() override;
+	encoding_descriptor& get_encoding(int context, unsigned char c) override;
+	const tree_node* decoding_lookup(int context, unsigned char c) override;
+	void write_coding_tree(bitbuffer& buffer) override;
+};
+
+#endif
@@ -0,0 +1,308 @@
+#include "stream.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coding.h"
+#include "tree.h"
+#include "utils.h"
+
+stream_encoder::stream_encoder(i_coding_provider& coder):
+	coder(coder), context(coder.initial_context()), pending_start(0), pending_end(0), partial(0),
+	partial_bits(0), finished(false), next_in(null), avail_in(0), next_out(null), avail_out(0) {
+	// blank header
+	int type = coder.get_type();
+	pending[pending_end++] = 1 << 7 | i_coding_provider::make_header(type, 0);
+	if(i_coding_provider::header_length(type) == 2) {
+		pending[pending_end++] = type;
+	}
+}
+
+stream_status stream_encoder::encode(bool finish) {
+	while(drain()) {
+		if(avail_in) {
+			encoding_descriptor& e = coder.get_encoding(context, *next_in);
+			if(e.length == 0) {
+				return stream_error;
+			}
+			push_encoding_descriptor(e);
+			context = coder.next_context(context, *next_in);
+			next_in++;
+			avail_in--;
+		} else if(finish && !finished) {
+			// partial byte and trailer
+			int remainder = (8 - partial_bits) % 8;
+			if(partial_bits) {
+				pending[pending_end++] = partial;
+			}
+			pending[pending_end++] = context >> 8;
+			pending[pending_end++] = context & 0xFF;
+			pending[pending_end++] = i_coding_provider::make_header(coder.get_type(), remainder);
+			finished = true;
+		} else {
+			return finished ? stream_end : stream_ok;
+		}
+	}
+	return stream_ok;
+}
+
+void stream_encoder::push_encoding_descriptor(const encoding_descriptor& descriptor) {
+	// same packing as bitbuffer::push_encoding_descriptor, whole bytes go to pending and the
+	// partial byte is carried
+	for(int j = 0; j < descriptor.length / 8; j++) {
+		unsigned char b = descriptor.encoding[j];
+		pending[pending_end++] = partial | b >> partial_bits;
+		partial = b << (8 - partial_bits);
+	}
+	if(descriptor.length % 8) {
+		int w = descriptor.length % 8;
+		unsigned char l = descriptor.encoding[descriptor.length / 8];
+		partial |= l >> partial_bits;
+		if(partial_bits + w >= 8) {
+			pending[pending_end++] = partial;
+			partial = l << (8 - partial_bits);
+			partial_bits = partial_bits + w - 8;
+		} else {
+			partial_bits += w;
+		}
+	}
+}
+
+bool stream_encoder::drain() {
+	size_t n = pending_end - pending_start;
+	if(n > avail_out) n = avail_out;
+	memcpy(next_out, pending + pending_start, n);
+	next_out += n;
+	avail_out -= n;
+	pending_start += n;
+	if(pending_start == pending_end) {
+		pending_start = pending_end = 0;
+		return true;
+	}
+	return false;
+}
+
+stream_decoder::stream_decoder(i_coding_provider& coder):
+	coder(coder), context(coder.initial_context()), header_read(0), header_length(0),
+	held_count(0), hold(0), window(0), window_bits(0), tail(false), trailer_context(-1), node(null),
+	failed(false), next_in(null), avail_in(0), next_out(null), avail_out(0) {}
+
+stream_status stream_decoder::decode(bool finish) {
+	if(failed) {
+		return stream_error;
+	}
+	if(!read_header()) {
+		if(failed || finish) {
+			failed = true;
+			return stream_error;
+		}
+		return stream_ok;
+	}
+	while(true) {
+		if(!decode_symbols()) {
+			failed = true;
+			return stream_error;
+		}
+		if(tail) {
+			if(node == null && window_bits == 0) {
+				if(trailer_context != -1 && trailer_context != context) {
+					failed = true;
+					return stream_error;
+				}
+				return stream_end;
+			}
+			// out of output space
+			return stream_ok;
+		}
+		if(avail_out == 0) {
+			return stream_ok;
+		}
+		if(avail_in) {
+			refill();
+		} else if(finish) {
+			if(!load_tail()) {
+				failed = true;
+				return stream_error;
+			}
+		} else {
+			return stream_ok;
+		}
+	}
+}
+
+bool stream_decoder::read_header() {
+	while(header_length == 0 || header_read < header_length) {
+		if(avail_in == 0) {
+			return false;
+		}
+		header[header_read++] = *next_in++;
+		avail_in--;
+		if(header_read == 1) {
+			header_length = (header[0] & 0x70) == 0x30 ? 1 : 2;
+		}
+	}
+	if(hold == 0) {
+		// transformed files are undone a block at a time by the file decoder only, and multi-byte
+		// symbols can't be decoded a byte at a time
+		if(i_coding_provider::parse_header(header, header_length) != coder.get_type() ||
+		   i_coding_provider::header_transform(header, header_length) || !coder.byte_symbols()) {
+			failed = true;
+			return false;
+		}
+		// a blank header means the stream ends with a trailer
+		hold = header[0] & 1 << 7 ? TRAILER_LENGTH + 1 : 1;
+	}
+	return true;
+}
+
+void stream_decoder::refill() {
+	while(window_bits <= 56 && avail_in) {
+		if(held_count == hold) {
+			window |= (uint64_t) held[0] << (56 - window_bits);
+			window_bits += 8;
+			memmove(held, held + 1, hold - 1);
+			held_count--;
+		}
+		held[held_count++] = *next_in++;
+		avail_in--;
+	}
+}
+
+bool stream_decoder::load_tail() {
+	// the data length is known now, move what's left of it into the window
+	assert(window_bits < 8);
+	unsigned char completed = header[0];
+	int data_bytes = held_count;
+	if(hold > 1) {
+		if(held_count < TRAILER_LENGTH) {
+			return false;
+		}
+		completed = held[held_count - 1];
+		data_bytes -= TRAILER_LENGTH;
+		// the trailer's context is checked once the last symbol is decoded
+		trailer_context = held[data_bytes] << 8 | held[data_bytes + 1];
+	}
+	int remainder = completed & 7;
+	if(data_bytes == 0) {
+		if(remainder != 0) return false;
+	} else {
+		window |= (uint64_t) held[0] << (56 - window_bits);
+		window_bits += 8 - remainder;
+		// clear the padding
+		window &= ~(uint64_t) 0 << (64 - window_bits);
+	}
+	held_count = 0;
+	tail = true;
+	return true;
+}
+
+void stream_decoder::consume(int n) {
+	window <<= n;
+	window_bits -= n;
+}
+
+bool stream_decoder::decode_symbols() {
+	while(avail_out) {
+		if(node == null) {
+			if(window_bits < 8 && !(tail && window_bits > 0)) {
+				break;
+			}
+			const tree_node* n = coder.decoding_lookup(context, window >> 56);
+			if(n == null) {
+				return false;
+			}
+			if(n->is_internal) {
+				// a codeword longer than 8 bits
+				if(window_bits < 8) {
+					return false;
+				}
+				node = n;
+				consume(8);
+			} else {
+				if(n->depth > window_bits) {
+					// only possible at the end of the data
+					return false;
+				}
+				consume(n->depth);
+				*next_out++ = n->value;
+				avail_out--;
+				context = coder.next_context(context, n->value);
+				continue;
+			}
+		}
+		// walk the rest of a long codeword, possibly across calls
+		while(node->is_internal && window_bits > 0) {
+			node = window >> 63 ? node->right : node->left;
+			consume(1);
+		}
+		if(node->is_internal) {
+			if(tail) {
+				return false;
+			}
+			break;
+		}
+		*next_out++ = node->value;
+		avail_out--;
+		context = coder.next_context(context, node->value);
+		node = null;
+	}
+	return true;
+}
+
+void stream_compress(i_coding_provider& coder, FILE* input_fd, FILE* output_fd) {
+	unsigned char input_buffer[STREAM_CHUNK_SIZE];
+	unsigned char output_buffer[STREAM_CHUNK_SIZE];
+	stream_encoder encoder(coder);
+	stream_status status = stream_ok;
+	while(status == stream_ok) {
+		encoder.next_in = input_buffer;
+		encoder.avail_in = read_buffer(input_buffer, 1, STREAM_CHUNK_SIZE, input_fd);
+		bool finish = feof(input_fd);
+		do {
+			encoder.next_out = output_buffer;
+			encoder.avail_out = STREAM_CHUNK_SIZE;
+			status = encoder.encode(finish);
+			write_buffer(output_buffer, 1, STREAM_CHUNK_SIZE - encoder.avail_out, output_fd);
+		} while(status == stream_ok && (encoder.avail_in || finish));
+	}
+	if(status == stream_error) {
+		eprintf("Error: Input contains a symbol which isn't in the encoding table, build the table from "
+		        "this input or with escapes (-k).\n");
+		exit(1);
+	}
+	if(output_fd != stdout)
+		fclose(output_fd);
+}
+
+void stream_decompress(i_coding_provider& coder, const unsigned char* prefix, int prefix_length,
+                       FILE* input_fd, FILE* output_fd) {
+	unsigned char input_buffer[STREAM_CHUNK_SIZE];
+	unsigned char output_buffer[STREAM_CHUNK_SIZE];
+	stream_decoder decoder(coder);
+	stream_status status = stream_ok;
+	bool first = true;
+	while(status == stream_ok) {
+		if(first) {
+			memcpy(input_buffer, prefix, prefix_length);
+			decoder.avail_in = prefix_length;
+			first = false;
+		} else {
+			decoder.avail_in = read_buffer(input_buffer, 1, STREAM_CHUNK_SIZE, input_fd);
+		}
+		decoder.next_in = input_buffer;
+		bool finish = feof(input_fd);
+		do {
+			decoder.next_out = output_buffer;
+			decoder.avail_out = STREAM_CHUNK_SIZE;
+			status = decoder.decode(finish);
+			write_buffer(output_buffer, 1, STREAM_CHUNK_SIZE - decoder.avail_out, output_fd);
+		} while(status == stream_ok && (decoder.avail_in || finish));
+	}
+	if(status == stream_error) {
+		eprintf("Error while decoding file: Input appears corrupt.\n");
+		exit(1);
+	}
+	if(output_fd != stdout)
+		fclose(output_fd);
+}
@@ -0,0 +1,96 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "coding.h"
+#include "tree.h"
+
+// Incremental encoding and decoding for data which arrives in arbitrary pieces, in the style of
+// zlib's deflate/inflate loop. Point next_in/avail_in at the available input and
+// next_out/avail_out at free output space and call encode/decode until the input is consumed.
+// Pass finish once there is no more input and keep calling until stream_end is returned.
+//
+// Both objects carry a small fixed amount of state between calls and never allocate. Streams are
+// written with a blank header and a trailer (see coding.cpp); the decoder accepts both streams and
+// regular compressed files.
+
+// size of the pieces the file helpers feed through the stream objects
+#define STREAM_CHUNK_SIZE 4096
+
+enum stream_status {
+	stream_ok,    // progress was made, more input or output space is needed
+	stream_end,   // the stream is complete
+	stream_error  // the input can't be coded
+};
+
+class stream_encoder {
+	i_coding_provider& coder;
+	int context;
+	// output waiting for space, at most one codeword plus the header or trailer
+	unsigned char pending[(MAX_CODE_LENGTH + 7) / 8 + TRAILER_LENGTH + 2];
+	int pending_start;
+	int pending_end;
+	// the partial byte and how many bits of it are used
+	unsigned char partial;
+	int partial_bits;
+	bool finished;
+public:
+	const unsigned char* next_in;
+	size_t avail_in;
+	unsigned char* next_out;
+	size_t avail_out;
+	stream_encoder(i_coding_provider& coder);
+	stream_status encode(bool finish);
+private:
+	void push_encoding_descriptor(const encoding_descriptor& descriptor);
+	// moves pending output to next_out, returns true if nothing is left pending
+	bool drain();
+};
+
+class stream_decoder {
+	i_coding_provider& coder;
+	int context;
+	unsigned char header[2];
+	int header_read;
+	int header_length;
+	// the last bytes of the input can't be decoded until the end of the input is known since they
+	// may be the partial byte or the trailer
+	unsigned char held[TRAILER_LENGTH + 1];
+	int held_count;
+	int hold;
+	// bit window, most significant bit first, bits past window_bits are zero
+	uint64_t window;
+	int window_bits;
+	// set once the window holds the exact end of the data
+	bool tail;
+	// final context recorded in the trailer, -1 if there's no trailer
+	int trailer_context;
+	// where a codeword longer than 8 bits left off
+	const tree_node* node;
+	bool failed;
+public:
+	const unsigned char* next_in;
+	size_t avail_in;
+	unsigned char* next_out;
+	size_t avail_out;
+	stream_decoder(i_coding_provider& coder);
+	stream_status decode(bool finish);
+private:
+	bool read_header();
+	void refill();
+	bool load_tail();
+	bool decode_symbols();
+	void consume(int n);
+};
+
+// Streaming counterparts to i_coding_provider::compress/decompress for inputs which can't be
+// seeked such as stdin. Any bytes already read from the input (e.g. to peek at the header) are
+// passed in as the prefix. The input is left open.
+void stream_compress(i_coding_provider& coder, FILE* input_fd, FILE* output_fd);
+void stream_decompress(i_coding_provider& coder, const unsigned char* prefix, int prefix_length,
+                       FILE* input_fd, FILE* output_fd);
+
+#endif
@@ -0,0 +1,150 @@
+#include "training.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "bitbuffer.h"
+#include "parallel.h"
+#include "utils.h"
+
+// 64-bit totals of every context, rows are allocated on first use
+struct training_totals {
+	std::mutex mutex;
+	std::vector<std::vector<long long>> rows;
+	// the first error any thread ran into, threads stop picking up files once it's set
+	std::string error;
+};
+
+static void fold(const context_counts& local, training_totals& totals) {
+	std::lock_guard<std::mutex> lock(totals.mutex);
+	for(int context = 0; context < local.contexts(); context++) {
+		if(const int* row = local.find(context)) {
+			std::vector<long long>& total = totals.rows[context];
+			if(total.empty()) {
+				total.resize(256);
+			}
+			for(int c = 0; c < 256; c++) {
+				total[c] += row[c];
+			}
+		}
+	}
+}
+
+static void fail(training_totals& totals, const std::string& error) {
+	std::lock_guard<std::mutex> lock(totals.mutex);
+	if(totals.error.empty()) {
+		totals.error = error;
+	}
+}
+
+long long count_directory(const char* directory, int type, const field_tracker& fields,
+                          context_counts& counts, long long& files) {
+	std::vector<std::string> paths;
+	std::error_code error;
+	std::filesystem::recursive_directory_iterator it(directory, error), end;
+	for(; !error && it != end; it.increment(error)) {
+		if(it->is_regular_file(error)) {
+			paths.push_back(it->path().string());
+		}
+	}
+	if(error) {
+		eprintf("Error while listing %s; %s.\n", directory, error.message().c_str());
+		exit(1);
+	}
+	training_totals totals;
+	totals.rows.resize(counts.contexts());
+	std::atomic<size_t> next(0);
+	std::atomic<long long> bytes(0);
+	// one task per thread, each with its own counts, taking files until there are none left
+	thread_pool::shared().parallel_for(parallel_threads, [&](int) {
+		context_counts* local = new context_counts(counts.contexts());
+		long long unfolded = 0;
+		unsigned char buffer[BUFFER_SIZE];
+		for(size_t k; (k = next++) < paths.size(); ) {
+			{
+				std::lock_guard<std::mutex> lock(totals.mutex);
+				if(!totals.error.empty()) break;
+			}
+			FILE* input_fd = fopen(paths[k].c_str(), "rb");
+			if(input_fd == null) {
+				fail(totals, "Error while opening " + paths[k] + "; " + strerror(errno) + ".");
+				break;
+			}
+			// every file starts over like a compressed file does
+			int prev = ' ';
+			int field = 0;
+			size_t bytes_read;
+			while((bytes_read = fread(buffer, 1, BUFFER_SIZE, input_fd)) > 0) {
+				if(type == 0) {
+					for(size_t i = 0; i < bytes_read; i++) {
+						local->add(0, buffer[i]);
+					}
+				} else if(type == 1 || type == 4) {
+					for(size_t i = 0; i < bytes_read; i++) {
+						local->add(prev, buffer[i]);
+						prev = buffer[i];
+					}
+				} else if(type == 5) {
+					// byte pairs, see wide_huffman.h, BUFFER_SIZE is even so pairs never straddle
+					// buffers
+					size_t i = 0;
+					for(; i + 1 < bytes_read; i += 2) {
+						local->add(buffer[i + 1], buffer[i]);
+					}
+					if(i < bytes_read) {
+						local->add(256, buffer[i]);
+					}
+				} else {
+					for(size_t i = 0; i < bytes_read; i++) {
+						local->add(256 * field + prev, buffer[i]);
+						field = fields.next_field[field][buffer[i]];
+						prev = buffer[i];
+					}
+				}
+				bytes += bytes_read;
+				unfolded += bytes_read;
+				if(unfolded >= TRAINING_FOLD_BYTES) {
+					fold(*local, totals);
+					delete local;
+					local = new context_counts(counts.contexts());
+					unfolded = 0;
+				}
+			}
+			if(ferror(input_fd)) {
+				fail(totals, "Error occurred while reading " + paths[k] + ".");
+			}
+			fclose(input_fd);
+		}
+		fold(*local, totals);
+		delete local;
+	});
+	if(!totals.error.empty()) {
+		eprintf("%s\n", totals.error.c_str());
+		exit(1);
+	}
+	for(int context = 0; context < counts.contexts(); context++) {
+		const std::vector<long long>& total = totals.rows[context];
+		if(total.empty()) continue;
+		long long sum = 0;
+		for(int c = 0; c < 256; c++) {
+			sum += total[c];
+		}
+		// keep every seen symbol at a count of at least one
+		long long scale = (sum + TRAINING_MAX_ROW_TOTAL - 1) / TRAINING_MAX_ROW_TOTAL;
+		int* row = counts.row(context);
+		for(int c = 0; c < 256; c++) {
+			if(total[c]) {
+				row[c] += total[c] / scale ? total[c] / scale : 1;
+			}
+		}
+	}
+	files = paths.size();
+	return bytes;
+}
@@ -0,0 +1,23 @@
+#ifndef TRAINING_H
+#define TRAINING_H
+
+#include "column_huffman.h"
+#include "counting.h"
+
+// Bytes a thread counts before folding its counts into the totals, low enough that no int count can
+// overflow in between
+#define TRAINING_FOLD_BYTES (1 << 30)
+// Rows whose total is over this are scaled down so tree weights fit in an int
+#define TRAINING_MAX_ROW_TOTAL (1 << 30)
+
+// Counts the symbols of every regular file under a directory (recursively) for a coder type, see
+// count_contexts in main. Files are handed out to the shared thread pool one at a time and read in
+// BUFFER_SIZE chunks, and each thread counts into its own sparse counts which are folded into 64-bit
+// totals, so memory is bounded by the thread count times the populated contexts rather than by the
+// corpus. Every file starts in the initial context like a compressed file does.
+// The counts are added to counts. Returns the number of bytes counted and sets files to the number
+// of files.
+long long count_directory(const char* directory, int type, const field_tracker& fields,
+                          context_counts& counts, long long& files);
+
+#endif
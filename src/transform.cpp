@@ -0,0 +1,140 @@
+#include "transform.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "utils.h"
+
+enum transform_kind { kind_delta = 1, kind_planes = 2, kind_both = 3 };
+
+int transform_id(const char* name) {
+	const char* colon = strchr(name, ':');
+	if(colon == null) {
+		return -1;
+	}
+	std::string kind(name, colon - name);
+	int width = atoi(colon + 1);
+	int k = kind == "delta" ? kind_delta : kind == "planes" ? kind_planes : kind == "delta+planes" ? kind_both : 0;
+	int log = width == 1 ? 0 : width == 2 ? 1 : width == 4 ? 2 : width == 8 ? 3 : -1;
+	if(k == 0 || log == -1 || strspn(colon + 1, "0123456789") != strlen(colon + 1)) {
+		return -1;
+	}
+	return k << 2 | log;
+}
+
+std::string transform_name(int id) {
+	const char* kinds[] = { "none", "delta", "planes", "delta+planes" };
+	return std::string(kinds[id >> 2 & 3]) + ":" + std::to_string(1 << (id & 3));
+}
+
+bool valid_transform(int id) {
+	return id >= 0 && id < 16 && (id == 0 || id >> 2 != 0);
+}
+
+// The loops below work on whole elements through memcpy so they compile to plain (unaligned) loads
+// and stores, the forward delta and both plane loops are vectorized by the compiler. The inverse
+// delta is a running sum.
+
+template<typename T>
+static void delta(const unsigned char* in, unsigned char* out, size_t elements) {
+	if(elements == 0) return;
+	memcpy(out, in, sizeof(T));
+	for(size_t i = 1; i < elements; i++) {
+		T a, b;
+		memcpy(&a, in + (i - 1) * sizeof(T), sizeof(T));
+		memcpy(&b, in + i * sizeof(T), sizeof(T));
+		b -= a;
+		memcpy(out + i * sizeof(T), &b, sizeof(T));
+	}
+}
+
+template<typename T>
+static void undelta(unsigned char* data, size_t elements) {
+	T sum = 0;
+	for(size_t i = 0; i < elements; i++) {
+		T d;
+		memcpy(&d, data + i * sizeof(T), sizeof(T));
+		sum += d;
+		memcpy(data + i * sizeof(T), &sum, sizeof(T));
+	}
+}
+
+template<int W>
+static void split(const unsigned char* in, unsigned char* out, size_t elements) {
+	for(int b = 0; b < W; b++) {
+		unsigned char* plane = out + b * elements;
+		for(size_t i = 0; i < elements; i++) {
+			plane[i] = in[i * W + b];
+		}
+	}
+}
+
+template<int W>
+static void join(const unsigned char* in, unsigned char* out, size_t elements) {
+	for(int b = 0; b < W; b++) {
+		const unsigned char* plane = in + b * elements;
+		for(size_t i = 0; i < elements; i++) {
+			out[i * W + b] = plane[i];
+		}
+	}
+}
+
+// transforms one block, scratch holds at least n bytes
+static void forward_block(int id, unsigned char* data, unsigned char* scratch, size_t n) {
+	int width = 1 << (id & 3);
+	size_t elements = n / width;
+	if(id >> 2 & kind_delta) {
+		switch(width) {
+			case 1: delta<uint8_t>(data, scratch, elements); break;
+			case 2: delta<uint16_t>(data, scratch, elements); break;
+			case 4: delta<uint32_t>(data, scratch, elements); break;
+			case 8: delta<uint64_t>(data, scratch, elements); break;
+		}
+		memcpy(data, scratch, elements * width);
+	}
+	if(id >> 2 & kind_planes) {
+		switch(width) {
+			case 1: return;
+			case 2: split<2>(data, scratch, elements); break;
+			case 4: split<4>(data, scratch, elements); break;
+			case 8: split<8>(data, scratch, elements); break;
+		}
+		memcpy(data, scratch, elements * width);
+	}
+}
+
+static void inverse_block(int id, unsigned char* data, unsigned char* scratch, size_t n) {
+	int width = 1 << (id & 3);
+	size_t elements = n / width;
+	if(id >> 2 & kind_planes && width > 1) {
+		switch(width) {
+			case 2: join<2>(data, scratch, elements); break;
+			case 4: join<4>(data, scratch, elements); break;
+			case 8: join<8>(data, scratch, elements); break;
+		}
+		memcpy(data, scratch, elements * width);
+	}
+	if(id >> 2 & kind_delta) {
+		switch(width) {
+			case 1: undelta<uint8_t>(data, elements); break;
+			case 2: undelta<uint16_t>(data, elements); break;
+			case 4: undelta<uint32_t>(data, elements); break;
+			case 8: undelta<uint64_t>(data, elements); break;
+		}
+	}
+}
+
+void forward_transform(int id, unsigned char* data, size_t n) {
+	unsigned char scratch[TRANSFORM_BLOCK];
+	for(size_t i = 0; i < n; i += TRANSFORM_BLOCK) {
+		forward_block(id, data + i, scratch, n - i < TRANSFORM_BLOCK ? n - i : TRANSFORM_BLOCK);
+	}
+}
+
+void inverse_transform(int id, unsigned char* data, size_t n) {
+	unsigned char scratch[TRANSFORM_BLOCK];
+	for(size_t i = 0; i < n; i += TRANSFORM_BLOCK) {
+		inverse_block(id, data + i, scratch, n - i < TRANSFORM_BLOCK ? n - i : TRANSFORM_BLOCK);
+	}
+}
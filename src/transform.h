@@ -0,0 +1,38 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stddef.h>
+#include <string>
+
+#include "bitbuffer.h"
+
+// Reversible transforms applied to the input before counting and coding, for fixed-width numeric
+// data which entropy codes poorly as raw bytes. Each block of TRANSFORM_BLOCK bytes is transformed
+// independently so the inverse can run on the decoder's output a block at a time. Elements are
+// little-endian and 1, 2, 4 or 8 bytes wide, bytes at the end of a block which don't make up a
+// whole element are left alone.
+//  delta:   every element but a block's first is replaced with its difference from the previous
+//           element, slowly changing values become small numbers
+//  planes:  the block's elements are split into byte planes, all the first bytes of the elements,
+//           then all the second bytes and so on, so bytes of the same significance are coded
+//           together
+//  delta+planes: delta then planes
+//
+// A transform ID packs the kind (1 delta, 2 planes, 3 both) in its upper two bits and the log2 of
+// the element width in its lower two, 0 is no transform. The ID is stored in the high nibble of
+// the coder type byte of the extended header (see coding.cpp).
+
+// A multiple of DIRECT_ALIGNMENT so transformed output can be written with O_DIRECT
+#define TRANSFORM_BLOCK BUFFER_SIZE
+
+// Parses "delta:W", "planes:W" or "delta+planes:W" and returns the transform ID, -1 if it isn't
+// one of those
+int transform_id(const char* name);
+std::string transform_name(int id);
+bool valid_transform(int id);
+// transform data in place, data starts at a block boundary and everything but the last block is
+// whole
+void forward_transform(int id, unsigned char* data, size_t n);
+void inverse_transform(int id, unsigned char* data, size_t n);
+
+#endif
@@ -6,6 +6,7 @@
 
 #include "utils.h"
 
+// Tree nodes don't own their children, nodes are pooled by the tree's owner.
 struct tree_node {
 	tree_node* left;
 	tree_node* right;
@@ -21,10 +22,8 @@ struct tree_node {
 		height(std::max(l->height, r->height) + 1), depth(-1) {}
 	tree_node(unsigned char v, int w):
 		left(null), right(null), is_internal(false), value(v), weight(w), height(0), depth(-1) {}
-	~tree_node() {
-		delete left;
-		delete right;
-	}
+	tree_node():
+		left(null), right(null), is_internal(false), value(0),  weight(0), height(0), depth(-1) {}
 	// print the tree in graphvis format
 	void print() const;
 	// print the tree in graphvis format as a subgraph with n = the next node index
@@ -7,9 +7,15 @@
 #include <string>
 #include <string.h>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+
 #ifdef _WIN32
 #include <io.h>
+#include <windows.h>
+#include <psapi.h>
 #elif __linux__
+#include <sys/resource.h>
 #include <unistd.h>
 #else
 #error "Unsupported platform."
@@ -76,3 +82,144 @@ int write_buffer(void* ptr, size_t size, size_t count, FILE* stream) {
 	}
 	return r;
 }
+
+int read_at(void* ptr, size_t count, long long offset, FILE* stream) {
+#ifdef _WIN32
+	// no pread, fall back to seeking
+	_fseeki64(stream, offset, SEEK_SET);
+	return read_buffer(ptr, 1, count, stream);
+#else
+	size_t total = 0;
+	while(total < count) {
+		ssize_t r = pread(fileno(stream), (char*) ptr + total, count - total, offset + total);
+		if(r == -1) {
+			if(errno == EINTR) continue;
+			eprintf("Error occurred while reading file; %s.\n", strerror(errno));
+			exit(1);
+		}
+		if(r == 0) break;
+		total += r;
+	}
+	return total;
+#endif
+}
+
+void write_at(const void* ptr, size_t count, long long offset, FILE* stream) {
+	if(fflush(stream) == EOF) {
+		eprintf("Error occurred while writing file; %s.\n", strerror(errno));
+		exit(1);
+	}
+#ifdef _WIN32
+	// no pwrite, fall back to seeking
+	long long pos = _ftelli64(stream);
+	_fseeki64(stream, offset, SEEK_SET);
+	write_buffer((void*) ptr, 1, count, stream);
+	fflush(stream);
+	_fseeki64(stream, pos, SEEK_SET);
+#else
+	size_t total = 0;
+	while(total < count) {
+		ssize_t r = pwrite(fileno(stream), (const char*) ptr + total, count - total, offset + total);
+		if(r == -1) {
+			if(errno == EINTR) continue;
+			eprintf("Error occurred while writing file; %s.\n", strerror(errno));
+			exit(1);
+		}
+		total += r;
+	}
+#endif
+}
+
+bool start_direct(FILE* stream) {
+#ifdef O_DIRECT
+	// buffered bytes aren't aligned, they have to go out before the descriptor is direct
+	if(fflush(stream) == EOF) {
+		eprintf("Error occurred while writing file; %s.\n", strerror(errno));
+		exit(1);
+	}
+	int flags = fcntl(fileno(stream), F_GETFL);
+	if(flags == -1 || fcntl(fileno(stream), F_SETFL, flags | O_DIRECT) == -1) {
+		eprintf("Warning: Direct output isn't supported here (%s), writing through the page cache.\n",
+		        strerror(errno));
+		return false;
+	}
+	return true;
+#else
+	eprintf("Warning: Direct output isn't supported on this platform, writing through the page cache.\n");
+	return false;
+#endif
+}
+
+void end_direct(FILE* stream) {
+#ifdef O_DIRECT
+	int flags = fcntl(fileno(stream), F_GETFL);
+	if(flags == -1 || fcntl(fileno(stream), F_SETFL, flags & ~O_DIRECT) == -1) {
+		eprintf("Error occurred while writing file; %s.\n", strerror(errno));
+		exit(1);
+	}
+#endif
+}
+
+FILE* reopen(FILE* stream) {
+#ifdef _WIN32
+	int fd = _dup(_fileno(stream));
+	FILE* copy = fd == -1 ? null : _fdopen(fd, "rb");
+#else
+	int fd = dup(fileno(stream));
+	FILE* copy = fd == -1 ? null : fdopen(fd, "rb");
+#endif
+	if(copy == null) {
+		eprintf("Error while opening file; %s.\n", strerror(errno));
+		exit(1);
+	}
+	// the copy shares the file position, start it at the beginning
+	fseek(copy, 0, SEEK_SET);
+	return copy;
+}
+
+long long file_size(FILE* stream) {
+#ifdef _WIN32
+	struct _stat64 s;
+	if(_fstat64(_fileno(stream), &s) == -1) {
+#else
+	struct stat s;
+	if(fstat(fileno(stream), &s) == -1) {
+#endif
+		eprintf("Error occurred while reading file size; %s.\n", strerror(errno));
+		exit(1);
+	}
+	return s.st_size;
+}
+
+long long peak_memory() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return 0;
+	}
+	return counters.PeakWorkingSetSize;
+#else
+	// ru_maxrss carries over the peak of the process which forked this one across exec, the high
+	// water mark in /proc only covers this program
+	FILE* status = fopen("/proc/self/status", "r");
+	if(status) {
+		char line[256];
+		long long kilobytes = -1;
+		while(fgets(line, sizeof(line), status)) {
+			if(sscanf(line, "VmHWM: %lld kB", &kilobytes) == 1) {
+				break;
+			}
+		}
+		fclose(status);
+		if(kilobytes != -1) {
+			return kilobytes * 1024;
+		}
+	}
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) == -1) {
+		return 0;
+	}
+	// kilobytes on linux
+	return (long long) usage.ru_maxrss * 1024;
+#endif
+}
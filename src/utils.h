@@ -20,4 +20,27 @@ void check_access(const char* path, bool write);
 int read_buffer(void* ptr, size_t size, size_t count, FILE* stream);
 int write_buffer(void* ptr, size_t size, size_t count, FILE* stream);
 
+// Positional read which doesn't touch the stream's file position (pread where available)
+// Returns the number of bytes read.
+int read_at(void* ptr, size_t count, long long offset, FILE* stream);
+
+// Positional write which doesn't touch the stream's file position (pwrite where available), anything
+// buffered in the stream is flushed first so it can't land over the write later
+void write_at(const void* ptr, size_t count, long long offset, FILE* stream);
+
+// Turns on O_DIRECT for a stream's file descriptor, anything buffered in the stream is flushed first.
+// Returns false after warning if the platform or file system doesn't support it.
+bool start_direct(FILE* stream);
+// Turns O_DIRECT back off, for writes which aren't aligned
+void end_direct(FILE* stream);
+
+// Opens a second stream for reading on the file behind a stream
+FILE* reopen(FILE* stream);
+
+// Returns the size of the file behind a stream
+long long file_size(FILE* stream);
+
+// Returns the peak resident set size of the process in bytes
+long long peak_memory();
+
 #endif
@@ -0,0 +1,70 @@
+#include "verify.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "coding.h"
+#include "parallel.h"
+#include "utils.h"
+
+long long verify(const char* encoding_input, const std::vector<const char*>& inputs, bool quiet) {
+	// the table doesn't say which coder wrote it, the headers vote so a few corrupt headers can't
+	// decide how it's read
+	std::map<int, long long> votes;
+	for(const char* input : inputs) {
+		FILE* input_fd = fopen(input, "rb");
+		if(input_fd == null) continue;
+		int type = i_coding_provider::peek_type(input_fd);
+		fclose(input_fd);
+		if(type != -1) {
+			votes[type]++;
+		}
+	}
+	i_coding_provider* coder = null;
+	if(!votes.empty()) {
+		int type = votes.begin()->first;
+		for(auto& vote : votes) {
+			if(vote.second > votes[type]) {
+				type = vote.first;
+			}
+		}
+		FILE* encoding_input_fd = fopen(encoding_input, "rb");
+		if(encoding_input_fd == null) {
+			eprintf("Error while opening encoding input; %s.\n", strerror(errno));
+			exit(1);
+		}
+		coder = i_coding_provider::load(type, encoding_input_fd);
+	}
+	std::mutex mutex;
+	std::atomic<long long> failed(0);
+	thread_pool::shared().parallel_for(inputs.size(), [&](int i) {
+		std::string error;
+		FILE* input_fd = fopen(inputs[i], "rb");
+		if(input_fd == null) {
+			error = std::string("can't open; ") + strerror(errno);
+		} else if(coder == null) {
+			// none of the headers were valid
+			fclose(input_fd);
+			error = "invalid header";
+		} else if(const char* problem = coder->verify(input_fd)) {
+			error = problem;
+		}
+		if(!error.empty()) {
+			failed++;
+		}
+		if(!error.empty() || !quiet) {
+			std::lock_guard<std::mutex> lock(mutex);
+			printf("%s: %s\n", inputs[i], error.empty() ? "ok" : error.c_str());
+		}
+	});
+	// the statuses come before anything the caller prints to stderr
+	fflush(stdout);
+	delete coder;
+	return failed;
+}
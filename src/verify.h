@@ -0,0 +1,15 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <vector>
+
+// Scrubs compressed files against an encoding table without extracting them, see
+// i_coding_provider::verify. Files are checked on the shared thread pool, one file per task, and
+// each file's status is printed to stdout as soon as it's known, "path: ok" or "path: error". Quiet
+// only prints the files which fail.
+// The table is loaded once for the coder type most of the files' headers give, files written with
+// another coder fail.
+// Returns the number of files which failed.
+long long verify(const char* encoding_input, const std::vector<const char*>& inputs, bool quiet);
+
+#endif
@@ -0,0 +1,391 @@
+#include "wide_huffman.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "bitbuffer.h"
+#include "bitreader.h"
+#include "bytesink.h"
+#include "coding.h"
+#include "counting.h"
+#include "min_pq.h"
+#include "transform.h"
+#include "utils.h"
+
+static void corrupt_table() {
+	eprintf("Error: Encoding table appears corrupt.\n");
+	exit(1);
+}
+
+static void corrupt() {
+	eprintf("Error while decoding file: Input appears corrupt.\n");
+	exit(1);
+}
+
+// huffman codeword lengths for the weights, nodes are numbered in the order they're made so every
+// parent comes after its children
+static int huffman_lengths(const std::vector<long long>& weights, std::vector<unsigned char>& lengths) {
+	int n = weights.size();
+	lengths.assign(n, 1);
+	if(n == 1) {
+		return 1;
+	}
+	std::vector<int> parent(2 * n - 1);
+	min_pq<long long, int> q;
+	std::vector<long long> node_weights(weights);
+	for(int i = 0; i < n; i++) {
+		q.insert(weights[i], i);
+	}
+	while(q.size() > 1) {
+		int a = q.pop_min();
+		int b = q.pop_min();
+		parent[a] = parent[b] = node_weights.size();
+		q.insert(node_weights[a] + node_weights[b], node_weights.size());
+		node_weights.push_back(node_weights[a] + node_weights[b]);
+	}
+	std::vector<int> depth(2 * n - 1, 0);
+	int longest = 0;
+	for(int i = 2 * n - 3; i >= 0; i--) {
+		depth[i] = depth[parent[i]] + 1;
+	}
+	for(int i = 0; i < n; i++) {
+		lengths[i] = std::min(depth[i], 255);
+		longest = std::max(longest, depth[i]);
+	}
+	return longest;
+}
+
+wide_huffman_table::wide_huffman_table(const context_counts& counts) {
+	// the context is the upper bits of the symbol, lone final bytes are in the context after the
+	// high bytes so they come out as WIDE_PAIRS + byte
+	std::vector<long long> weights;
+	for(int context = 0; context < counts.contexts() && context < WIDE_ESCAPE >> 8; context++) {
+		if(const int* row = counts.find(context)) {
+			for(int c = 0; c < 256; c++) {
+				if(row[c]) {
+					symbols.push_back(context << 8 | c);
+					weights.push_back(row[c]);
+				}
+			}
+		}
+	}
+	symbols.push_back(WIDE_ESCAPE);
+	weights.push_back(1);
+	// halve the weights until the tree is shallow enough, every weight stays at least 1 so this ends
+	// with a balanced tree at worst, which is 17 levels deep
+	while(huffman_lengths(weights, lengths) > WIDE_MAX_CODE_LENGTH) {
+		for(long long& weight : weights) {
+			weight = 1 + weight / 2;
+		}
+	}
+	build_tables();
+}
+
+static int pop_bits(bitbuffer& buffer, int n) {
+	int v = 0;
+	for(int i = 0; i < n; i++) {
+		v = v << 1 | buffer.pop_bit();
+	}
+	return v;
+}
+
+wide_huffman_table::wide_huffman_table(bitbuffer& buffer) {
+	// pop leading indicator bit
+	buffer.pop_bit();
+	if(buffer.pop_byte() != 5) {
+		eprintf("Error: Encoding table is not a valid wide encoding table.\n");
+		exit(1);
+	}
+	int n = pop_bits(buffer, WIDE_SYMBOL_BITS);
+	if(n < 1 || n > WIDE_SYMBOLS) {
+		corrupt_table();
+	}
+	long long kraft = 0;
+	for(int i = 0; i < n; i++) {
+		int symbol = pop_bits(buffer, WIDE_SYMBOL_BITS);
+		int length = pop_bits(buffer, 5);
+		// symbols are in order and the code has to fit in the code space
+		if(symbol >= WIDE_SYMBOLS || (i && symbol <= symbols.back()) || length < 1 ||
+		   length > WIDE_MAX_CODE_LENGTH) {
+			corrupt_table();
+		}
+		kraft += 1 << (WIDE_MAX_CODE_LENGTH - length);
+		symbols.push_back(symbol);
+		lengths.push_back(length);
+	}
+	// the escape is always there, it's the largest symbol
+	if(kraft > 1 << WIDE_MAX_CODE_LENGTH || symbols.back() != WIDE_ESCAPE) {
+		corrupt_table();
+	}
+	build_tables();
+}
+
+void wide_huffman_table::build_tables() {
+	int n = symbols.size();
+	// canonical codewords, counting up through the symbols ordered by length
+	std::vector<int> order(n);
+	for(int i = 0; i < n; i++) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+		return lengths[a] < lengths[b];
+	});
+	for(int& slot : slots) {
+		slot = 0;
+	}
+	// slot 0 is the empty codeword symbols without one map to
+	codes.assign(1, { 0, 0 });
+	entries.assign(1 << WIDE_ROOT_BITS, { 0, 0, 0 });
+	// longest codeword under each root prefix, which sizes its subtable
+	unsigned char longest[1 << WIDE_ROOT_BITS] = {};
+	std::vector<uint32_t> bits(n);
+	uint32_t next = 0;
+	int length = 0;
+	for(int i : order) {
+		next <<= lengths[i] - length;
+		length = lengths[i];
+		bits[i] = next++;
+		int symbol = symbols[i];
+		if(slots[symbol >> 8] == 0) {
+			slots[symbol >> 8] = codes.size();
+			codes.resize(codes.size() + 256, { 0, 0 });
+		}
+		codes[slots[symbol >> 8] + (symbol & 0xFF)] = { bits[i], length };
+		if(length <= WIDE_ROOT_BITS) {
+			int start = bits[i] << (WIDE_ROOT_BITS - length);
+			for(int j = 0; j < 1 << (WIDE_ROOT_BITS - length); j++) {
+				entries[start + j] = { symbol, (unsigned char) length, 0 };
+			}
+		} else {
+			longest[bits[i] >> (length - WIDE_ROOT_BITS)] = length;
+		}
+	}
+	// subtables for the longer codewords
+	for(int prefix = 0; prefix < 1 << WIDE_ROOT_BITS; prefix++) {
+		if(longest[prefix]) {
+			int link_bits = longest[prefix] - WIDE_ROOT_BITS;
+			entries[prefix] = { (int) entries.size(), 0, (unsigned char) link_bits };
+			entries.resize(entries.size() + (1 << link_bits), { 0, 0, 0 });
+		}
+	}
+	for(int i : order) {
+		if(lengths[i] <= WIDE_ROOT_BITS) continue;
+		int rest = lengths[i] - WIDE_ROOT_BITS;
+		const decode_entry& link = entries[bits[i] >> rest];
+		int start = link.value + ((bits[i] & ((1 << rest) - 1)) << (link.link_bits - rest));
+		for(int j = 0; j < 1 << (link.link_bits - rest); j++) {
+			entries[start + j] = { symbols[i], lengths[i], 0 };
+		}
+	}
+}
+
+int wide_huffman_table::get_type() {
+	return 5;
+}
+
+void wide_huffman_table::print_table() {
+	printf("Table:\n");
+	for(size_t i = 0; i < symbols.size(); i++) {
+		int symbol = symbols[i];
+		const code& c = lookup(symbol);
+		if(symbol < WIDE_PAIRS) {
+			printf("0x%04x %d ", symbol, c.length);
+		} else if(symbol < WIDE_ESCAPE) {
+			printf("lone 0x%02x %d ", symbol - WIDE_PAIRS, c.length);
+		} else {
+			printf("escape %d ", c.length);
+		}
+		for(int j = c.length - 1; j >= 0; j--) {
+			printf("%d", c.bits >> j & 1);
+		}
+		printf("\n");
+	}
+}
+
+void wide_huffman_table::print_tree() {
+	// the code is canonical, there's no tree to print
+	printf("graph G {\n}\n");
+}
+
+long long wide_huffman_table::table_length() {
+	// see write_coding_tree
+	return 1 + 8 + WIDE_SYMBOL_BITS + (long long) symbols.size() * (WIDE_SYMBOL_BITS + 5);
+}
+
+long long wide_huffman_table::coded_length(const context_counts& counts) {
+	// the symbol is the context's upper bits and the row's lower bits, see the constructor
+	long long bits = 0;
+	for(int context = 0; context < counts.contexts(); context++) {
+		const int* row = counts.find(context);
+		if(row == null) continue;
+		for(int c = 0; c < 256; c++) {
+			if(row[c]) {
+				int length = lookup(context << 8 | c).length;
+				bits += (long long) row[c] * (length ? length : lookup(WIDE_ESCAPE).length + WIDE_SYMBOL_BITS);
+			}
+		}
+	}
+	return bits;
+}
+
+long long wide_huffman_table::footprint(const context_counts& counts) {
+	long long symbols = 1;
+	long long blocks = 1;
+	for(int context = 0; context < counts.contexts(); context++) {
+		if(const int* row = counts.find(context)) {
+			blocks++;
+			for(int c = 0; c < 256; c++) {
+				if(row[c]) {
+					symbols++;
+				}
+			}
+		}
+	}
+	// subtables are estimated at two entries per symbol
+	return sizeof(wide_huffman_table) + symbols * (sizeof(int) + 1) + blocks * 256 * sizeof(code) +
+	       ((1 << WIDE_ROOT_BITS) + 2 * symbols) * sizeof(decode_entry);
+}
+
+encoding_descriptor& wide_huffman_table::get_encoding(int, unsigned char) {
+	// the byte-at-a-time paths check byte_symbols, this is only reached by streaming which reports
+	// the missing codeword
+	static encoding_descriptor none;
+	return none;
+}
+
+const tree_node* wide_huffman_table::decoding_lookup(int, unsigned char) {
+	return null;
+}
+
+/*
+ * Output file format:
+ * Like markov-huffman files, wide tables start with a 1 followed by the 8-bit coder type. Then the
+ * 17-bit symbol count and each symbol with its codeword length in symbol order:
+ * [1] [type: 8 bits] [n: 17 bits] ([symbol: 17 bits] [length: 5 bits]) * n
+ * The codewords are canonical so the lengths are all the decoder needs.
+ *
+ */
+
+void wide_huffman_table::write_coding_tree(bitbuffer& buffer) {
+	buffer.push_bit(1);
+	buffer.push_byte(get_type());
+	buffer.push_bits(symbols.size(), WIDE_SYMBOL_BITS);
+	for(size_t i = 0; i < symbols.size(); i++) {
+		buffer.push_bits(symbols[i], WIDE_SYMBOL_BITS);
+		buffer.push_bits(lengths[i], 5);
+	}
+}
+
+bool wide_huffman_table::byte_symbols() {
+	return false;
+}
+
+void wide_huffman_table::push_symbol(bitbuffer& output_buffer, int symbol) {
+	const code& c = lookup(symbol);
+	if(c.length) {
+		output_buffer.push_bits(c.bits, c.length);
+	} else {
+		const code& escape = lookup(WIDE_ESCAPE);
+		output_buffer.push_bits(escape.bits, escape.length);
+		output_buffer.push_bits(symbol, WIDE_SYMBOL_BITS);
+	}
+}
+
+int wide_huffman_table::encode(FILE* input_fd, bitbuffer& output_buffer, int context, int, int transform) {
+	size_t bytes_read;
+	unsigned char input_buffer[BUFFER_SIZE];
+	// reads only come up short at the end and BUFFER_SIZE is even, so only the last buffer can end
+	// with a lone byte
+	while(bytes_read = read_buffer(input_buffer, 1, BUFFER_SIZE, input_fd)) {
+		if(transform) {
+			forward_transform(transform, input_buffer, bytes_read);
+		}
+		size_t i = 0;
+		for(; i + 1 < bytes_read; i += 2) {
+			push_symbol(output_buffer, input_buffer[i] | input_buffer[i + 1] << 8);
+		}
+		if(i < bytes_read) {
+			push_symbol(output_buffer, WIDE_PAIRS + input_buffer[i]);
+		}
+	}
+	// Check for read errors
+	if(bytes_read == -1) {
+		eprintf("Error occurred while reading input; %s.\n", strerror(errno));
+		exit(1);
+	}
+	return context;
+}
+
+inline int wide_huffman_table::next_symbol(bitreader& input_buffer) const {
+	input_buffer.refill();
+	decode_entry e = entries[input_buffer.peek(WIDE_ROOT_BITS)];
+	if(e.link_bits) {
+		e = entries[e.value + (input_buffer.peek(WIDE_ROOT_BITS + e.link_bits) & ((1 << e.link_bits) - 1))];
+	}
+	// bits no codeword starts with, the code is incomplete
+	if(e.length == 0) {
+		return -1;
+	}
+	input_buffer.consume(e.length);
+	int symbol = e.value;
+	if(symbol == WIDE_ESCAPE) {
+		// at most WIDE_MAX_CODE_LENGTH bits were consumed since the refill
+		symbol = input_buffer.peek(WIDE_SYMBOL_BITS);
+		input_buffer.consume(WIDE_SYMBOL_BITS);
+		if(symbol >= WIDE_ESCAPE) {
+			return -1;
+		}
+	}
+	return symbol;
+}
+
+bool wide_huffman_table::verify_data(bitreader& input_buffer, int&) {
+	// the context never changes
+	while(input_buffer.remaining() > 0) {
+		if(next_symbol(input_buffer) == -1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void wide_huffman_table::decode(FILE* input_fd, int, long long size, long long length, bytesink& output) {
+	// the symbols don't synchronize like bytes do so this is always serial
+	// the reader keeps track of the length and owns the input from here on
+	bitreader input_buffer(input_fd, size, length);
+	while(input_buffer.remaining() > 0 && !output.stopped()) {
+		// as in i_coding_provider::decode, this many symbols can't run past the end of the data
+		size_t batch = input_buffer.remaining() / (WIDE_MAX_CODE_LENGTH + WIDE_SYMBOL_BITS);
+		batch = batch > DECODE_BATCH ? DECODE_BATCH : batch ? batch : 1;
+		size_t n = 2 * batch;
+		unsigned char* out = output.reserve(n);
+		if(n < 2) {
+			// the last byte of caller memory, a pair doesn't fit and push_bytes reports it
+			int symbol = next_symbol(input_buffer);
+			if(symbol == -1) {
+				corrupt();
+			}
+			unsigned char bytes[2] = { (unsigned char) symbol, (unsigned char) (symbol >> 8) };
+			output.push_bytes(bytes, symbol < WIDE_PAIRS ? 2 : 1);
+			continue;
+		}
+		for(size_t k = n / 2; k; k--) {
+			int symbol = next_symbol(input_buffer);
+			if(symbol == -1) {
+				corrupt();
+			}
+			*out++ = symbol;
+			if(symbol < WIDE_PAIRS) {
+				*out++ = symbol >> 8;
+			}
+		}
+		output.commit(out);
+	}
+	// the last codeword ran past the end of the data
+	if(input_buffer.remaining() != 0 && !output.stopped()) {
+		corrupt();
+	}
+	// the bitreader will close the input
+}
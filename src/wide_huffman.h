@@ -0,0 +1,102 @@
+#ifndef WIDE_HUFFMAN_H
+#define WIDE_HUFFMAN_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "bitbuffer.h"
+#include "bitreader.h"
+#include "bytesink.h"
+#include "coding.h"
+#include "counting.h"
+
+// Symbols of the wide alphabet: the 65536 little-endian byte pairs, 256 symbols for a lone final
+// byte of an odd length input and an escape
+#define WIDE_PAIRS 65536
+#define WIDE_ESCAPE (WIDE_PAIRS + 256)
+#define WIDE_SYMBOLS (WIDE_ESCAPE + 1)
+// bits of a symbol following the escape
+#define WIDE_SYMBOL_BITS 17
+// Codewords are limited to this length so a codeword (plus the escaped symbol) fits in one
+// bitreader peek and the decode tables stay small
+#define WIDE_MAX_CODE_LENGTH 20
+// bits resolved by the first level of the decode table
+#define WIDE_ROOT_BITS 11
+
+// Order-0 huffman coding over 16-bit symbols, for UTF-16 text and word-oriented binary data where a
+// byte pair carries more structure than either byte alone and half as many symbols get coded.
+//
+// Counts are taken in a context_counts with the high byte of a pair as the context and the low byte
+// as the symbol, plus one context for lone final bytes (see count_contexts in main), so only the
+// high bytes which occur take memory. The same goes for the encoding table, which is split into
+// blocks of 256 codewords allocated for the high bytes which occur.
+//
+// Codes are canonical and length-limited to WIDE_MAX_CODE_LENGTH bits: counts are halved until the
+// huffman tree is shallow enough, as in bzip2. Only (symbol, length) pairs of the symbols which
+// occur are written to the table file. An escape symbol is always part of the code and is followed
+// by the symbol's WIDE_SYMBOL_BITS bits, so a table built from a sample or another input codes
+// anything.
+//
+// Decoding goes through a two-level table instead of a tree: the next WIDE_ROOT_BITS bits index a
+// root table whose entries either resolve a codeword or point at a subtable for the longer
+// codewords sharing that prefix, sized for the longest of them.
+class wide_huffman_table: public i_coding_provider {
+	struct code {
+		uint32_t bits;
+		int length;
+	};
+	struct decode_entry {
+		// symbol, or the start of the subtable for a link
+		int value;
+		// codeword length, 0 for a link or a bit pattern no codeword starts with
+		unsigned char length;
+		// index bits of the linked subtable, 0 unless this is a link
+		unsigned char link_bits;
+	};
+	// symbols and codeword lengths in symbol order, what the table file holds
+	std::vector<int> symbols;
+	std::vector<unsigned char> lengths;
+	// start of the codeword block of each symbol's upper bits, 0 while none of its symbols have one
+	int slots[WIDE_SYMBOLS / 256 + 1];
+	// the empty codeword followed by the blocks
+	std::vector<code> codes;
+	// root table followed by the subtables
+	std::vector<decode_entry> entries;
+public:
+	wide_huffman_table(const context_counts& counts);
+	wide_huffman_table(bitbuffer& buffer);
+	wide_huffman_table(const wide_huffman_table& other) = delete;
+	wide_huffman_table& operator=(const wide_huffman_table& other) = delete;
+	wide_huffman_table(wide_huffman_table&& other) = delete;
+	wide_huffman_table& operator=(wide_huffman_table&& other) = delete;
+	int get_type() override;
+	void print_table() override;
+	void print_tree() override;
+	long long table_length() override;
+	long long coded_length(const context_counts& counts) override;
+	// symbols aren't bytes, these aren't used
+	encoding_descriptor& get_encoding(int context, unsigned char c) override;
+	const tree_node* decoding_lookup(int context, unsigned char c) override;
+	void write_coding_tree(bitbuffer& buffer) override;
+	// estimated bytes held by a table built from the counts
+	static long long footprint(const context_counts& counts);
+private:
+	int encode(FILE* input_fd, bitbuffer& output_buffer, int context, int pair_contexts,
+	           int transform) override;
+	void decode(FILE* input_fd, int header_length, long long size, long long length,
+	            bytesink& output) override;
+	bool byte_symbols() override;
+	bool verify_data(bitreader& input_buffer, int& context) override;
+	// decodes the next symbol, -1 if the bits aren't a codeword
+	int next_symbol(bitreader& input_buffer) const;
+	// codeword of a symbol, length 0 if it has none
+	const code& lookup(int symbol) const {
+		int slot = slots[symbol >> 8];
+		return codes[slot ? slot + (symbol & 0xFF) : 0];
+	}
+	void push_symbol(bitbuffer& output_buffer, int symbol);
+	// assigns canonical codewords to symbols and lengths and builds the encode and decode tables
+	void build_tables();
+};
+
+#endif
@@ -0,0 +1,123 @@
+import colorama
+import os
+import random
+import shutil
+import subprocess
+import sys
+import time
+from prettytable import PrettyTable
+
+# Throughput gates
+# Compresses and extracts a generated corpus in each coding mode and fails if throughput drops below
+# the floors below. The floors are deliberately loose so they catch regressions in the hot loops
+# rather than machine noise, BENCH_SCALE scales them for slower or faster machines.
+#
+# Given more than one binary (e.g. the LTO and PGO builds) every binary is measured and compared
+# against the first.
+#
+# usage: python3 test/bench.py [corpus MB] [binary ...]
+
+working_dir = "test/.bench"
+exe = "bin/markovhuffman.exe" if sys.platform == "win32" else "bin/markovhuffman"
+runs = 3
+
+# (name, flags, minimum compress MB/s, minimum extract MB/s)
+modes = [
+	("huffman", ["-h"], 40, 60),
+	("markov", [], 30, 30),
+	("stream", ["-i"], 30, 25)
+]
+
+def generate_corpus(path, size):
+	# order-1 text-like source: skewed successor distributions per byte, deterministic
+	rng = random.Random(0)
+	alphabet = list(range(32, 127)) + [10]
+	successors = []
+	for _ in range(256):
+		choices = rng.sample(alphabet, 24)
+		weights = [1 / (i + 1) for i in range(len(choices))]
+		successors.append(rng.choices(choices, weights, k=4096))
+	block = bytearray()
+	c = ord(" ")
+	for i in range(1 << 20):
+		c = successors[c][rng.randrange(4096)]
+		block.append(c)
+	with open(path, "wb") as f:
+		for _ in range(size):
+			f.write(block)
+
+def measure(exe, corpus, name, flags):
+	# returns (compress seconds, extract seconds)
+	compressed, encoding = os.path.join(working_dir, name + ".c"), os.path.join(working_dir, name + ".e")
+	# the table is built once up front so the timings measure coding, not counting
+	best_time([exe, corpus, "-o", compressed, "-d", encoding] + [flag for flag in flags if flag != "-i"])
+	if "-i" in flags:
+		compress = best_time([exe, "-i", "-e", encoding, "-o", compressed], corpus)
+		extract = best_time([exe, "-ix", "-e", encoding], compressed)
+	else:
+		compress = best_time([exe, corpus, "-o", compressed, "-e", encoding] + flags)
+		extract = best_time([exe, compressed, "-x", "-e", encoding, "-o", os.devnull] + flags)
+	return compress, extract
+
+def best_time(args, stdin=None, stdout=subprocess.DEVNULL):
+	best = None
+	for _ in range(runs):
+		fin = open(stdin, "rb") if stdin else None
+		start = time.perf_counter()
+		p = subprocess.run(args, stdin=fin, stdout=stdout, stderr=subprocess.PIPE)
+		elapsed = time.perf_counter() - start
+		if fin: fin.close()
+		if p.returncode != 0:
+			print("Error: {} failed\n{}".format(" ".join(args), p.stderr.decode("utf-8", "replace")))
+			sys.exit(1)
+		best = elapsed if best is None else min(best, elapsed)
+	return best
+
+def main():
+	size = int(sys.argv[1]) if len(sys.argv) > 1 else 16
+	binaries = sys.argv[2:] if len(sys.argv) > 2 else [exe]
+	scale = float(os.environ.get("BENCH_SCALE", "1"))
+	for binary in binaries:
+		if not os.path.exists(binary):
+			print("Error: {} doesn't exist, run make first.".format(binary))
+			sys.exit(1)
+	if os.path.exists(working_dir):
+		shutil.rmtree(working_dir)
+	os.mkdir(working_dir)
+	corpus = os.path.join(working_dir, "corpus")
+	generate_corpus(corpus, size)
+	mb = os.path.getsize(corpus) / 1e6
+
+	table = PrettyTable(["binary", "mode", "compress MB/s", "extract MB/s", "compress floor", "extract floor", "result"])
+	regressed = False
+	baseline = {}
+	for binary in binaries:
+		for name, flags, compress_floor, extract_floor in modes:
+			compress, extract = measure(binary, corpus, name, flags)
+			compress, extract = mb / compress, mb / extract
+			ok = compress >= compress_floor * scale and extract >= extract_floor * scale
+			regressed |= not ok
+			# later binaries are compared against the first
+			if name in baseline:
+				compress_text = "{:.1f} ({:+.0f}%)".format(compress, 100 * (compress / baseline[name][0] - 1))
+				extract_text = "{:.1f} ({:+.0f}%)".format(extract, 100 * (extract / baseline[name][1] - 1))
+			else:
+				baseline[name] = (compress, extract)
+				compress_text, extract_text = "{:.1f}".format(compress), "{:.1f}".format(extract)
+			table.add_row([
+				os.path.basename(binary),
+				name,
+				compress_text,
+				extract_text,
+				"{:.1f}".format(compress_floor * scale),
+				"{:.1f}".format(extract_floor * scale),
+				(colorama.Style.BRIGHT + colorama.Fore.GREEN + "Good" if ok else colorama.Style.BRIGHT + colorama.Fore.RED + "Slow") + colorama.Style.RESET_ALL
+			])
+	print("{:.1f} MB corpus, best of {} runs".format(mb, runs))
+	print(table)
+	shutil.rmtree(working_dir)
+	if regressed:
+		sys.exit(1)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,292 @@
+import colorama
+import os
+import random
+import shutil
+import subprocess
+import sys
+
+# Differential round-trip fuzzing
+# - Synthetic inputs covering the edge cases of the coders (empty input, single symbol trees, long
+#   codewords, ...) are round-tripped through every coding mode and every decoder. Every decoder
+#   must reproduce the input exactly.
+# - Encoding tables and compressed files are mutated and fed back to the decoders, which must fail
+#   cleanly (a nonzero exit, not a signal or a hang).
+# - Every few iterations an input large enough for parallel extraction (over PARALLEL_DECODE_CHUNK of
+#   compressed data) is extracted with -j 4, clean and mutated, and has to give exactly what serial
+#   extraction gives, output and exit status alike.
+# - verify has to accept every file the round trips write, and a mutated file it accepts has to
+#   extract.
+#
+# usage: python3 test/fuzz.py [iterations] [seed]
+
+working_dir = "test/.fuzz"
+exe = "bin/markovhuffman.exe" if sys.platform == "win32" else "bin/markovhuffman"
+timeout = 60
+failed = 0
+
+# (name, compression flags)
+modes = [
+	("huffman", ["-h"]),
+	("markov", []),
+	("columns", ["-c", "3"]),
+	("sampled", ["-r", "10"]),
+	("auto", ["-a"]),
+	("capped", ["-c", "3", "-m", "64"]),
+	("pairs", ["-p", "32"]),
+	("threads", ["-c", "3", "-j", "4"]),
+	("escaped", ["-k"]),
+	("transformed", ["-t", "delta+planes:2"]),
+	("wide", ["-w"])
+]
+
+# Every decoder has to agree with the reference file extraction. New decode paths go here, decoders
+# which only kick in on large inputs go in large() instead.
+# (name, flags, read compressed file from stdin)
+decoders = [
+	("extract", ["-x"], False),
+	("stream", ["-ix"], True)
+]
+
+#
+# synthetic distributions
+#
+
+def gen_empty(rng, n):
+	return b""
+
+def gen_single(rng, n):
+	# single symbol trees use the height 0 hack in huffman_table::build
+	return bytes([rng.randrange(256)]) * max(n, 1)
+
+def gen_two(rng, n):
+	a, b = rng.sample(range(256), 2)
+	return bytes(rng.choice([a, a, a, b]) for _ in range(n))
+
+def gen_uniform(rng, n):
+	return bytes(rng.randrange(256) for _ in range(n))
+
+def gen_zipf(rng, n):
+	alphabet = rng.sample(range(256), rng.randint(2, 256))
+	weights = [1 / (i + 1) ** rng.uniform(0.5, 2) for i in range(len(alphabet))]
+	return bytes(rng.choices(alphabet, weights, k=n))
+
+def gen_fibonacci(rng, n):
+	# Fibonacci weights make the most lopsided huffman trees, giving codewords well over 8 bits
+	alphabet = rng.sample(range(256), 30)
+	weights = [1, 1]
+	while len(weights) < len(alphabet):
+		weights.append(weights[-1] + weights[-2])
+	return bytes(rng.choices(alphabet, weights, k=n))
+
+def gen_markov(rng, n):
+	# sparse order-1 chain, most contexts only see a few successors
+	successors = [rng.sample(range(256), rng.randint(1, 4)) for _ in range(256)]
+	out = bytearray()
+	c = rng.randrange(256)
+	for _ in range(n):
+		c = rng.choice(successors[c])
+		out.append(c)
+	return bytes(out)
+
+def gen_records(rng, n):
+	out = []
+	size = 0
+	while size < n:
+		line = ",".join(str(rng.randint(0, 10 ** rng.randint(1, 6))) for _ in range(rng.randint(1, 6))) + "\n"
+		out.append(line)
+		size += len(line)
+	return "".join(out).encode()
+
+generators = [gen_empty, gen_single, gen_two, gen_uniform, gen_zipf, gen_fibonacci, gen_markov, gen_records]
+
+#
+# helpers
+#
+
+def run(args, stdin=None):
+	fin = open(stdin, "rb") if stdin else None
+	try:
+		p = subprocess.run(args, stdin=fin, stdout=subprocess.PIPE, stderr=subprocess.PIPE, timeout=timeout)
+		return p.returncode, p.stdout, p.stderr
+	except subprocess.TimeoutExpired:
+		return None, b"", b"timeout"
+	finally:
+		if fin: fin.close()
+
+def report(ok, description, case=None):
+	global failed
+	if not ok:
+		failed += 1
+		print(colorama.Style.BRIGHT + colorama.Fore.RED + "FAILED" + colorama.Style.RESET_ALL + " " + description)
+		if case:
+			print("\tcase saved to {}".format(case))
+
+def save_case(name, data):
+	path = os.path.join(working_dir, "failed_" + name)
+	with open(path, "wb") as f:
+		f.write(data)
+	return path
+
+def crashed(returncode):
+	# negative return codes mean the process was killed by a signal, None is a timeout
+	return returncode is None or returncode < 0
+
+def mutate(rng, data):
+	data = bytearray(data)
+	kind = rng.randrange(4)
+	if kind == 0 and data:
+		for _ in range(rng.randint(1, 8)):
+			i = rng.randrange(len(data))
+			data[i] ^= 1 << rng.randrange(8)
+	elif kind == 1 and data:
+		data = data[:rng.randrange(len(data))]
+	elif kind == 2:
+		data += bytes(rng.randrange(256) for _ in range(rng.randint(1, 64)))
+	else:
+		data = bytes(rng.randrange(256) for _ in range(rng.randint(0, 2 * len(data) + 1)))
+	return bytes(data)
+
+#
+# fuzz cases
+#
+
+def roundtrip(rng, i):
+	# every distribution once, then random picks
+	generator = generators[i] if i < len(generators) else rng.choice(generators)
+	data = generator(rng, rng.choice([1, 2, 100, 5000, 50000]))
+	base = os.path.join(working_dir, "case")
+	source = base + ".in"
+	with open(source, "wb") as f:
+		f.write(data)
+	for mode, flags in modes:
+		compressed, table = base + "." + mode + ".c", base + "." + mode + ".e"
+		streamed = base + "." + mode + ".s"
+		description = "{} round trip #{} ({}, {} bytes)".format(mode, i, generator.__name__, len(data))
+		rc, out, err = run([exe, source, "-o", compressed, "-d", table] + flags)
+		if rc != 0:
+			report(False, description + ": compression failed\n" + err.decode("utf-8", "replace"), save_case("roundtrip.in", data))
+			continue
+		# estimates are printed for sampled tables, an empty sample has nothing to divide by
+		ok = b"nan" not in err
+		report(ok, description + ": bad estimate\n" + err.decode("utf-8", "replace"), None if ok else save_case("roundtrip.in", data))
+		encoded_files = [compressed]
+		# automatically selected tables can't be reused for compression, transforms and wide symbols
+		# can't be streamed
+		streamable = "-t" not in flags and "-w" not in flags
+		if "-a" not in flags and streamable:
+			rc, out, err = run([exe, "-i", "-e", table, "-o", streamed] + flags, source)
+			if rc != 0:
+				report(False, description + ": stream compression failed\n" + err.decode("utf-8", "replace"), save_case("roundtrip.in", data))
+				continue
+			encoded_files.append(streamed)
+		for encoded in encoded_files:
+			for name, decode_flags, use_stdin in decoders:
+				if use_stdin and not streamable:
+					continue
+				if use_stdin:
+					rc, out, err = run([exe, "-e", table] + decode_flags, encoded)
+				else:
+					rc, out, err = run([exe, encoded, "-e", table] + decode_flags)
+				ok = rc == 0 and out == data
+				report(ok, "{}: {} decoder on {}".format(description, name, os.path.basename(encoded)), None if ok else save_case("roundtrip.in", data))
+			rc, out, err = run([exe, "verify", encoded, "-e", table])
+			ok = rc == 0
+			report(ok, "{}: verify on {}\n{}".format(description, os.path.basename(encoded), out.decode("utf-8", "replace")), None if ok else save_case("roundtrip.in", data))
+	return data
+
+def corrupt(rng, i, data):
+	# mutate the tables and compressed files of the last round trip
+	base = os.path.join(working_dir, "case")
+	mode, flags = rng.choice(modes)
+	compressed, table = base + "." + mode + ".c", base + "." + mode + ".e"
+	if not os.path.exists(compressed):
+		return
+	mutated_table, mutated_compressed = base + ".bad.e", base + ".bad.c"
+	with open(table, "rb") as f:
+		table_data = f.read()
+	with open(compressed, "rb") as f:
+		compressed_data = f.read()
+	for path, original in [(mutated_table, table_data), (mutated_compressed, compressed_data)]:
+		with open(path, "wb") as f:
+			f.write(mutate(rng, original))
+	source = os.path.join(working_dir, "case.in")
+	for args, stdin, what in [
+		([exe, compressed, "-x", "-e", mutated_table], None, mutated_table),
+		([exe, mutated_compressed, "-x", "-e", table], None, mutated_compressed),
+		([exe, "-ix", "-e", table], mutated_compressed, mutated_compressed),
+		([exe, source, "-o", os.devnull, "-e", mutated_table] + flags, None, mutated_table),
+		([exe, "verify", compressed, "-e", mutated_table], None, mutated_table),
+		([exe, "verify", mutated_compressed, "-e", table], None, mutated_compressed)
+	]:
+		rc, out, err = run(args, stdin)
+		if crashed(rc):
+			with open(what, "rb") as f:
+				case = save_case("corrupt_" + os.path.basename(what), f.read())
+			report(False, "{} corruption #{}: {} ({})".format(mode, i, " ".join(args), "timeout" if rc is None else "signal {}".format(-rc)), case)
+	# extraction doesn't look at the padding or the trailer, anything verify accepts it extracts
+	for encoded, encoding in [(compressed, mutated_table), (mutated_compressed, table)]:
+		if run([exe, "verify", encoded, "-e", encoding])[0] == 0:
+			rc, out, err = run([exe, encoded, "-x", "-e", encoding])
+			if rc != 0:
+				case = save_case("verified_" + os.path.basename(encoded), open(encoded, "rb").read())
+				report(False, "{} corruption #{}: verify accepted {} but extraction failed".format(mode, i, encoded), case)
+
+def large(rng, i):
+	# parallel extraction only runs on over 1MB of compressed data, the small round trips never get
+	# there
+	base = os.path.join(working_dir, "large")
+	source, compressed, table, mutated = base + ".in", base + ".c", base + ".e", base + ".bad.c"
+	generator = rng.choice([gen_uniform, gen_zipf, gen_markov, gen_records])
+	data = generator(rng, rng.randint(3, 5) * 1000000)
+	mode, flags = rng.choice([("huffman", ["-h"]), ("markov", []), ("columns", ["-c", "3"])])
+	# well compressing distributions get repeated until there's enough compressed data
+	while True:
+		with open(source, "wb") as f:
+			f.write(data)
+		description = "{} large #{} ({}, {} bytes)".format(mode, i, generator.__name__, len(data))
+		rc, out, err = run([exe, source, "-o", compressed, "-d", table] + flags)
+		if rc != 0:
+			report(False, description + ": compression failed\n" + err.decode("utf-8", "replace"))
+			return
+		if os.path.getsize(compressed) > 1 << 20:
+			break
+		data += data
+	rc, out, err = run([exe, compressed, "-x", "-e", table, "-j", "4"])
+	report(rc == 0 and out == data, description + ": parallel extraction")
+	with open(compressed, "rb") as f:
+		compressed_data = f.read()
+	for _ in range(4):
+		with open(mutated, "wb") as f:
+			f.write(mutate(rng, compressed_data))
+		serial = run([exe, mutated, "-x", "-e", table, "-j", "1"])
+		parallel = run([exe, mutated, "-x", "-e", table, "-j", "4"])
+		# a failed extraction leaves whatever it wrote before noticing, only the status is compared
+		ok = not crashed(parallel[0]) and serial[0] == parallel[0] and (serial[0] != 0 or serial[1] == parallel[1])
+		report(ok, "{}: parallel extraction of a mutated file ({}, serial {})".format(description,
+			"timeout" if parallel[0] is None else "exit {}".format(parallel[0]), serial[0]),
+			None if ok else save_case("large_" + os.path.basename(mutated), open(mutated, "rb").read()))
+
+def main():
+	iterations = int(sys.argv[1]) if len(sys.argv) > 1 else 40
+	seed = int(sys.argv[2]) if len(sys.argv) > 2 else 0
+	if not os.path.exists(exe):
+		print("Error: {} doesn't exist, run make first.".format(exe))
+		sys.exit(1)
+	if os.path.exists(working_dir):
+		shutil.rmtree(working_dir)
+	os.mkdir(working_dir)
+	rng = random.Random(seed)
+	print("fuzzing {} iterations with seed {}...".format(iterations, seed))
+	for i in range(iterations):
+		data = roundtrip(rng, i)
+		for _ in range(4):
+			corrupt(rng, i, data)
+		if i % 20 == 0:
+			large(rng, i)
+	if failed:
+		print("{} failures, cases left in {}".format(failed, working_dir))
+		sys.exit(1)
+	shutil.rmtree(working_dir)
+	print(colorama.Style.BRIGHT + colorama.Fore.GREEN + "Good" + colorama.Style.RESET_ALL)
+
+main()
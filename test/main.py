@@ -1,15 +1,20 @@
 import colorama
 import filecmp
+import math
 import os
 import prettytable
 import shutil
+import socket
+import struct
 import subprocess
 import sys
+import time
 
 working_dir = "test/.tmp"
 exe = "bin/markovhuffman.exe" if sys.platform == "win32" else "bin/markovhuffman"
 tests = []
 output = None
+mode_output = None
 failed = 0
 def Test(fn):
 	tests.append(fn)
@@ -104,6 +109,251 @@ def run_test(input_file):
 		global failed
 		failed += 1
 
+def report_mode(input_file, mode, correct, ratio):
+	mode_output.add_row([
+		os.path.basename(input_file),
+		mode,
+		colorama.Style.BRIGHT + (colorama.Fore.GREEN + "Good" if correct else colorama.Fore.RED + "FAILED") + colorama.Style.RESET_ALL,
+		"{:.02f}".format(ratio)
+	])
+	if not correct:
+		global failed
+		failed += 1
+
+def run_stages(stages):
+	# runs (args, stage[, stdin file[, stdout file]]) in order and stops at the first stage which fails
+	for args, stage, *files in stages:
+		stdin, stdout = (files + [None, None])[:2]
+		fin = open(stdin, "rb") if stdin else None
+		fout = open(stdout, "wb") if stdout else subprocess.PIPE
+		p = subprocess.Popen(args, stdin=fin, stdout=fout, stderr=subprocess.PIPE)
+		out, err = p.communicate()
+		if fin: fin.close()
+		if stdout: fout.close()
+		if p.returncode != 0:
+			print("Error while {}".format(stage))
+			print(err.decode("utf-8"))
+			sys.exit(1)
+
+def run_mode_test(input_file, mode, flags):
+	# round trip through a coding mode which isn't part of the main comparison
+	assert(os.path.exists(input_file))
+	print("checking {} ({})...".format(input_file, mode))
+	base = os.path.join(working_dir, os.path.basename(input_file) + "." + mode)
+	encoded, table, decoded = base + ".c", base + ".e", base + ".d"
+	run_stages([
+		([exe, input_file, "-o", encoded, "-d", table] + flags, "encoding"),
+		([exe, encoded, "-o", decoded, "-x", "-e", table], "decoding")
+	])
+	correct = filecmp.cmp(input_file, decoded)
+	report_mode(input_file, mode, correct, os.path.getsize(encoded) / os.path.getsize(input_file))
+
+def run_stream_test(input_file):
+	# stream through stdin with an existing table and check the streamed output against regular
+	# extraction and the other way around
+	assert(os.path.exists(input_file))
+	print("checking {} (stream)...".format(input_file))
+	base = os.path.join(working_dir, os.path.basename(input_file) + ".stream")
+	encoded, table = encode(input_file, False)
+	streamed, decoded_stream, decoded_file, decoded_legacy = base + ".c", base + ".d1", base + ".d2", base + ".d3"
+	run_stages([
+		([exe, "-i", "-e", table, "-o", streamed], "streaming", input_file),
+		([exe, "-ix", "-e", table], "streaming", streamed, decoded_stream),
+		([exe, streamed, "-x", "-e", table, "-o", decoded_file], "streaming"),
+		([exe, "-ix", "-e", table, "-o", decoded_legacy], "streaming", encoded)
+	])
+	correct = all(filecmp.cmp(input_file, f) for f in [decoded_stream, decoded_file, decoded_legacy])
+	report_mode(input_file, "stream", correct, os.path.getsize(streamed) / os.path.getsize(input_file))
+
+def run_train_test(directory, input_file):
+	# train a table on a directory and round trip a file which wasn't part of it
+	assert(os.path.exists(directory) and os.path.exists(input_file))
+	print("checking {} (train)...".format(input_file))
+	base = os.path.join(working_dir, os.path.basename(input_file) + ".train")
+	table, encoded, decoded = base + ".e", base + ".c", base + ".d"
+	run_stages([
+		([exe, "train", directory, "-d", table, "-j", "2"], "training"),
+		([exe, input_file, "-o", encoded, "-e", table], "encoding"),
+		([exe, encoded, "-o", decoded, "-x", "-e", table], "decoding")
+	])
+	correct = filecmp.cmp(input_file, decoded)
+	report_mode(input_file, "train", correct, os.path.getsize(encoded) / os.path.getsize(input_file))
+
+def run_shared_table_test(table_file, input_file):
+	# a table built from one file with escapes codes another file, a plain markov-huffman table has
+	# to refuse rather than write garbage
+	assert(os.path.exists(table_file) and os.path.exists(input_file))
+	print("checking {} (escaped)...".format(input_file))
+	base = os.path.join(working_dir, os.path.basename(input_file) + ".escaped")
+	table, plain_table, encoded, decoded = base + ".e", base + ".pe", base + ".c", base + ".d"
+	run_stages([
+		([exe, table_file, "-o", os.devnull, "-k", "-d", table], "building the table"),
+		([exe, table_file, "-o", os.devnull, "-d", plain_table], "building the table"),
+		([exe, input_file, "-o", encoded, "-k", "-e", table], "encoding"),
+		([exe, encoded, "-o", decoded, "-x", "-e", table], "decoding")
+	])
+	refused = subprocess.run([exe, input_file, "-o", os.devnull, "-e", plain_table], stderr=subprocess.PIPE).returncode == 1
+	correct = filecmp.cmp(input_file, decoded) and refused
+	report_mode(input_file, "escaped", correct, os.path.getsize(encoded) / os.path.getsize(input_file))
+
+def run_parallel_test(input_file, copies, flags):
+	# extract a file large enough to be split between threads, every chunk after the first starts
+	# decoding at a guess and has to synchronize
+	assert(os.path.exists(input_file))
+	print("checking {} (parallel)...".format(input_file))
+	base = os.path.join(working_dir, os.path.basename(input_file) + ".parallel")
+	large, encoded, table, decoded = base, base + ".c", base + ".e", base + ".d"
+	with open(input_file, "rb") as f:
+		data = f.read()
+	with open(large, "wb") as f:
+		for _ in range(copies):
+			f.write(data)
+	run_stages([
+		([exe, large, "-o", encoded, "-d", table] + flags, "encoding"),
+		([exe, encoded, "-o", decoded, "-x", "-e", table, "-j", "4"], "decoding")
+	])
+	correct = filecmp.cmp(large, decoded)
+	report_mode(input_file, "parallel", correct, os.path.getsize(encoded) / os.path.getsize(large))
+
+def run_grep_test(input_file, patterns):
+	# search the compressed file and compare with the lines a plain search of the input finds
+	assert(os.path.exists(input_file))
+	print("checking {} (grep)...".format(input_file))
+	encoded, table = encode(input_file, False)
+	with open(input_file, "rb") as f:
+		data = f.read()
+	correct = True
+	for pattern in patterns:
+		expected, offset = b"", 0
+		# like grep, a final newline doesn't start another line
+		for line in data.split(b"\n")[:-1] if data.endswith(b"\n") else data.split(b"\n"):
+			if pattern.encode() in line:
+				expected += str(offset).encode() + b":" + line + b"\n"
+			offset += len(line) + 1
+		p = subprocess.run([exe, "grep", pattern, encoded, "-e", table], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+		q = subprocess.run([exe, "grep", "-q", pattern, encoded, "-e", table], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+		correct &= p.stdout == expected and p.returncode == (0 if expected else 1) and \
+			q.stdout == b"" and q.returncode == p.returncode
+	report_mode(input_file, "grep", correct, os.path.getsize(encoded) / os.path.getsize(input_file))
+
+def run_append_test(input_files):
+	# compress the first file and append the others, once to a compressed file and once to a stream
+	assert(all(os.path.exists(input_file) for input_file in input_files))
+	print("checking {} (append)...".format(input_files[0]))
+	base = os.path.join(working_dir, os.path.basename(input_files[0]) + ".append")
+	joined, table, compressed, streamed, decoded = base, base + ".e", base + ".c", base + ".s", base + ".d"
+	with open(joined, "wb") as f:
+		for input_file in input_files:
+			with open(input_file, "rb") as part:
+				f.write(part.read())
+	stages = [
+		([exe, joined, "-o", os.devnull, "-d", table], "building the table"),
+		([exe, input_files[0], "-o", compressed, "-e", table], "encoding"),
+		([exe, "-i", "-e", table, "-o", streamed], "streaming", input_files[0])
+	]
+	for input_file in input_files[1:]:
+		stages += [
+			([exe, "append", input_file, "-o", compressed, "-e", table], "appending"),
+			([exe, "append", input_file, "-o", streamed, "-e", table], "appending")
+		]
+	run_stages(stages)
+	correct = filecmp.cmp(compressed, streamed, shallow=False)
+	for args in [[exe, compressed, "-x", "-e", table, "-o", decoded], [exe, "-ix", "-e", table, "-o", decoded]]:
+		fin = open(compressed, "rb") if "-ix" in args else None
+		p = subprocess.run(args, stdin=fin, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+		if fin: fin.close()
+		correct &= p.returncode == 0 and filecmp.cmp(joined, decoded, shallow=False)
+	report_mode(input_files[0], "append", correct, os.path.getsize(compressed) / os.path.getsize(joined))
+
+def run_verify_test(input_file):
+	# verify intact plain and streamed files next to damaged ones, each file gets its own status
+	assert(os.path.exists(input_file))
+	print("checking {} (verify)...".format(input_file))
+	base = os.path.join(working_dir, os.path.basename(input_file) + ".verify")
+	encoded, table = encode(input_file, False)
+	simple, _ = encode(input_file, True)
+	streamed, bad_header, bad_trailer = base + ".s", base + ".header", base + ".trailer"
+	run_stages([([exe, "-i", "-e", table, "-o", streamed], "streaming", input_file)])
+	with open(encoded, "rb") as f:
+		data = f.read()
+	with open(bad_header, "wb") as f:
+		f.write(b"\x00" + data[1:])
+	with open(streamed, "rb") as f:
+		data = f.read()
+	# the trailer is [context high][context low][header]
+	with open(bad_trailer, "wb") as f:
+		f.write(data[:-3] + b"\xff\xff" + data[-1:])
+	expected = {
+		encoded: "ok",
+		streamed: "ok",
+		bad_header: "invalid header",
+		bad_trailer: "trailer context does not match the data",
+		simple: "encoding method does not match the encoding table",
+		base + ".missing": "can't open; No such file or directory"
+	}
+	def statuses(args):
+		p = subprocess.run([exe, "verify"] + args + ["-e", table], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+		# files finish in any order
+		return p.returncode, dict(line.split(": ", 1) for line in p.stdout.decode("utf-8").splitlines())
+	code, found = statuses(list(expected))
+	quiet_code, quiet_found = statuses(["-q"] + list(expected))
+	clean_code, clean_found = statuses([encoded, streamed])
+	correct = code == 1 and found == expected and \
+		quiet_code == 1 and quiet_found == {k: v for k, v in expected.items() if v != "ok"} and \
+		clean_code == 0 and clean_found == {encoded: "ok", streamed: "ok"}
+	report_mode(input_file, "verify", correct, os.path.getsize(encoded) / os.path.getsize(input_file))
+
+def run_daemon_test(input_file):
+	# round trip through a daemon, also into memory of the decoded size (with a transformed file, and
+	# with too little memory), check corrupt input and output which doesn't fit only take down one
+	# worker each and the table is only parsed once per worker
+	assert(os.path.exists(input_file))
+	print("checking {} (daemon)...".format(input_file))
+	base = os.path.join(working_dir, os.path.basename(input_file) + ".daemon")
+	encoded, table = encode(input_file, False)
+	path, compressed, decoded, corrupt = base + ".sock", base + ".c", base + ".d", base + ".bad"
+	transformed, transformed_table, sized = base + ".t", base + ".te", base + ".sized"
+	with open(corrupt, "wb") as f:
+		f.write(b"1" + b"\xff" * 64)
+	run_stages([([exe, input_file, "-t", "delta:1", "-o", transformed, "-d", transformed_table], "encoding")])
+	size = str(os.path.getsize(input_file))
+	daemon = subprocess.Popen([exe, "-l", path, "-j", "2"], stderr=subprocess.PIPE)
+	while not os.path.exists(path) and daemon.poll() is None:
+		time.sleep(0.01)
+	def request(line):
+		connection = socket.socket(socket.AF_UNIX)
+		connection.connect(path)
+		connection.sendall((line + "\n").encode())
+		response = b""
+		while not (response.endswith(b"ok\n") or b"Error" in response):
+			chunk = connection.recv(4096)
+			if not chunk: break
+			response += chunk
+		connection.close()
+		return response.decode("utf-8", "replace")
+	results = [
+		request("\t".join(["compress", "1", table, input_file, compressed])).endswith("ok\n"),
+		request("\t".join(["extract", table, corrupt, decoded])).startswith("Error"),
+		request("\t".join(["extract", table, compressed, decoded])).endswith("ok\n"),
+		request("\t".join(["extract", table, compressed, sized, size])).endswith("ok\n") and
+			filecmp.cmp(input_file, sized, shallow=False),
+		request("\t".join(["extract", transformed_table, transformed, sized, size])).endswith("ok\n") and
+			filecmp.cmp(input_file, sized, shallow=False),
+		"larger than the buffer" in request("\t".join(["extract", table, compressed, sized, str(int(size) - 1)])),
+		request("\t".join(["extract", table, compressed, sized, "many"])).startswith("Error")
+	]
+	# the daemon replaces a worker once it has noticed it exited, each of the four workers parses each
+	# of the two tables at most once
+	for _ in range(100):
+		stats = dict(line.split(" ") for line in request("stats").splitlines()[:-1])
+		if stats["restarts"] == "2": break
+		time.sleep(0.01)
+	daemon.terminate()
+	daemon.communicate()
+	correct = all(results) and filecmp.cmp(input_file, decoded) and stats["restarts"] == "2" and \
+		int(stats["cache_misses"]) <= 8 and not os.path.exists(path)
+	report_mode(input_file, "daemon", correct, os.path.getsize(compressed) / os.path.getsize(input_file))
+
 #@Test
 #def test_a():
 #	run_test("test/input/input_a.txt")
@@ -115,18 +365,69 @@ def run_test(input_file):
 @Test
 def test_ipsum():
 	run_test("test/input/input_ipsum.txt")
+	run_daemon_test("test/input/input_ipsum.txt")
+	run_mode_test("test/input/input_ipsum.txt", "auto", ["-a"])
+	run_grep_test("test/input/input_ipsum.txt", ["dolor", "Lorem ipsum", "not in the text", ""])
 
 @Test
 def test_wiki_cpp():
 	run_test("test/input/input_wiki_cpp.txt")
+	run_append_test(["test/input/input_wiki_cpp.txt", "test/input/input_ipsum.txt", "test/input/input_a.txt"])
+	run_verify_test("test/input/input_wiki_cpp.txt")
+	# already compressed, should be stored
+	run_mode_test(os.path.join(working_dir, "input_wiki_cpp.txt.gz"), "auto", ["-a"])
 
 @Test
 def test_wiki_cpp_html():
 	run_test("test/input/input_wiki_cpp.html")
+	run_stream_test("test/input/input_wiki_cpp.html")
+	run_mode_test("test/input/input_wiki_cpp.html", "pairs", ["-p", "32"])
+	run_mode_test("test/input/input_wiki_cpp.html", "direct", ["-u"])
+	run_shared_table_test("test/input/input_ipsum.txt", "test/input/input_wiki_cpp.html")
+	run_parallel_test("test/input/input_wiki_cpp.html", 24, [])
 
 @Test
 def test_exe():
 	run_test(exe)
+	# the binary has symbols none of the text inputs have
+	run_train_test("test/input", exe)
+
+@Test
+def test_records():
+	run_test("test/input/input_records.csv")
+	run_mode_test("test/input/input_records.csv", "columns", ["-c", "5"])
+	# a 16 column table used to take over 50MB when every context was allocated
+	run_mode_test("test/input/input_records.csv", "capped", ["-c", "16", "-m", "32"])
+	run_parallel_test("test/input/input_records.csv", 200, ["-c", "5"])
+
+@Test
+def test_utf16():
+	# the wiki text as UTF-16, once with a lone byte at the end
+	for name, tail in [("input_utf16.txt", b""), ("input_utf16_odd.txt", b"!")]:
+		input_file = os.path.join(working_dir, name)
+		with open("test/input/input_wiki_cpp.txt", "rb") as f:
+			text = f.read().decode("utf-8", "replace")
+		with open(input_file, "wb") as f:
+			f.write(text.encode("utf-16-le") + tail)
+		run_mode_test(input_file, "markov", [])
+		run_mode_test(input_file, "wide", ["-w"])
+	run_mode_test(input_file, "sampled wide", ["-w", "-r", "10"])
+	run_mode_test(exe, "wide", ["-w"])
+
+@Test
+def test_numeric():
+	# slowly changing 32-bit little-endian integers with a few bytes which don't make up a whole
+	# element at the end, what the transforms are for
+	input_file = os.path.join(working_dir, "input_numeric.bin")
+	values = [int(1000000 + 50000 * math.sin(i / 300) + i * 7919 % 41) for i in range(300000)]
+	with open(input_file, "wb") as f:
+		f.write(struct.pack("<{}i".format(len(values)), *values) + b"end")
+	run_mode_test(input_file, "plain", [])
+	run_mode_test(input_file, "delta", ["-t", "delta:4"])
+	run_mode_test(input_file, "planes", ["-t", "planes:4"])
+	run_mode_test(input_file, "delta+planes", ["-t", "delta+planes:4"])
+	run_mode_test(input_file, "sampled delta", ["-t", "delta:4", "-r", "10"])
+	run_parallel_test(input_file, 8, ["-t", "delta+planes:4"])
 
 def main():
 	if os.path.exists(working_dir):
@@ -146,6 +447,10 @@ def main():
 	output = prettytable.PrettyTable()
 	output.field_names = ["Test file", "Status", "Huffman", "Markov-Huffman", "gz", "bz", "gz + Markov-Huffman", "bz + Markov-Huffman"]
 	output.align = "l"
+	global mode_output
+	mode_output = prettytable.PrettyTable()
+	mode_output.field_names = ["Test file", "Mode", "Status", "Ratio"]
+	mode_output.align = "l"
 	# setup workspace
 	os.mkdir(working_dir)
 	# run tests
@@ -153,6 +458,7 @@ def main():
 	# cleanup
 	shutil.rmtree(working_dir)
 	print(output)
+	print(mode_output)
 	if failed:
 		sys.exit(1)
 
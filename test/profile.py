@@ -0,0 +1,55 @@
+import os
+import shutil
+import subprocess
+import sys
+
+from bench import generate_corpus
+
+# Training workload for the profile-guided build
+# Runs an instrumented binary over the files in test/input and a generated corpus, compressing and
+# extracting in simple huffman and markov-huffman coding (plus streaming and pairs) so the profile
+# covers the table builders and the hot coding loops in proportion to real use.
+#
+# usage: python3 test/profile.py <instrumented binary>
+
+working_dir = "test/.profile"
+inputs = "test/input"
+
+# (name, compression flags)
+modes = [
+	("huffman", ["-h"]),
+	("markov", []),
+	("pairs", ["-p", "32"])
+]
+
+def run(args, stdin=None):
+	fin = open(stdin, "rb") if stdin else None
+	p = subprocess.run(args, stdin=fin, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+	if fin: fin.close()
+	if p.returncode != 0:
+		print("Error: {} failed\n{}".format(" ".join(args), p.stderr.decode("utf-8", "replace")))
+		sys.exit(1)
+
+def main():
+	if len(sys.argv) < 2 or not os.path.exists(sys.argv[1]):
+		print("usage: python3 test/profile.py <instrumented binary>")
+		sys.exit(1)
+	exe = sys.argv[1]
+	if os.path.exists(working_dir):
+		shutil.rmtree(working_dir)
+	os.mkdir(working_dir)
+	corpus = os.path.join(working_dir, "corpus")
+	generate_corpus(corpus, 8)
+	files = [os.path.join(inputs, name) for name in sorted(os.listdir(inputs))] + [corpus]
+	for path in files:
+		for name, flags in modes:
+			base = os.path.join(working_dir, os.path.basename(path) + "." + name)
+			compressed, table = base + ".c", base + ".e"
+			run([exe, path, "-o", compressed, "-d", table] + flags)
+			run([exe, compressed, "-x", "-e", table, "-o", os.devnull])
+		streamed = os.path.join(working_dir, os.path.basename(path) + ".s")
+		run([exe, "-i", "-e", os.path.join(working_dir, os.path.basename(path) + ".markov.e"), "-o", streamed], path)
+		run([exe, "-ix", "-e", os.path.join(working_dir, os.path.basename(path) + ".markov.e")], streamed)
+	shutil.rmtree(working_dir)
+
+main()